@@ -0,0 +1,179 @@
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "bqueue.h"
+
+/**
+ * struct bqueue - Queue and the threads waiting on it
+ * @lock: protects every other field
+ * @has_room: producers wait on it for the queue to drop below @capacity
+ * @has_elements: consumers wait on it for the queue not to be empty
+ * @q: the queue
+ * @capacity: number of elements above which producers wait, zero for none
+ * @waiting_producers: producers waiting on @has_room
+ * @waiting_consumers: consumers waiting on @has_elements
+ * @producer_waits: times a producer had to wait
+ * @consumer_waits: times a consumer had to wait
+ * @closed: set by bq_close()
+ */
+struct bqueue {
+    pthread_mutex_t lock;
+    pthread_cond_t has_room;
+    pthread_cond_t has_elements;
+    struct list_head *q;
+    int capacity;
+    int waiting_producers;
+    int waiting_consumers;
+    long producer_waits;
+    long consumer_waits;
+    bool closed;
+};
+
+bqueue_t *bq_new(int capacity)
+{
+    bqueue_t *bq = malloc(sizeof(bqueue_t));
+    if (!bq)
+        return NULL;
+    bq->q = q_new();
+    if (!bq->q) {
+        free(bq);
+        return NULL;
+    }
+
+    /* Deadlines are taken on the monotonic clock */
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&bq->has_room, &attr);
+    pthread_cond_init(&bq->has_elements, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&bq->lock, NULL);
+
+    bq->capacity = capacity > 0 ? capacity : 0;
+    bq->waiting_producers = 0;
+    bq->waiting_consumers = 0;
+    bq->producer_waits = 0;
+    bq->consumer_waits = 0;
+    bq->closed = false;
+    return bq;
+}
+
+void bq_free(bqueue_t *bq)
+{
+    if (!bq)
+        return;
+    pthread_cond_destroy(&bq->has_room);
+    pthread_cond_destroy(&bq->has_elements);
+    pthread_mutex_destroy(&bq->lock);
+    q_free(bq->q);
+    free(bq);
+}
+
+void bq_close(bqueue_t *bq)
+{
+    pthread_mutex_lock(&bq->lock);
+    bq->closed = true;
+    pthread_cond_broadcast(&bq->has_room);
+    pthread_cond_broadcast(&bq->has_elements);
+    pthread_mutex_unlock(&bq->lock);
+}
+
+static inline bool has_room(const bqueue_t *bq)
+{
+    return !bq->capacity || q_size(bq->q) < bq->capacity;
+}
+
+/* Deadline @timeout milliseconds from now, NULL if @timeout is negative */
+static struct timespec *deadline_of(struct timespec *ts, int timeout)
+{
+    if (timeout < 0)
+        return NULL;
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += timeout / 1000;
+    ts->tv_nsec += (long) (timeout % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+/* Wait on @cond with the lock held. Return false once @deadline passed */
+static bool wait_on(bqueue_t *bq,
+                    pthread_cond_t *cond,
+                    const struct timespec *deadline)
+{
+    if (!deadline)
+        return !pthread_cond_wait(cond, &bq->lock);
+    return pthread_cond_timedwait(cond, &bq->lock, deadline) != ETIMEDOUT;
+}
+
+bool q_push_blocking(bqueue_t *bq, struct list_head *list, int n, int timeout)
+{
+    if (list_empty(list))
+        return true;
+
+    struct timespec ts, *deadline = deadline_of(&ts, timeout);
+    pthread_mutex_lock(&bq->lock);
+    while (!bq->closed && !has_room(bq)) {
+        bq->waiting_producers++;
+        bq->producer_waits++;
+        bool more = wait_on(bq, &bq->has_room, deadline);
+        bq->waiting_producers--;
+        if (!more)
+            break;
+    }
+
+    bool ok = !bq->closed && has_room(bq);
+    if (ok) {
+        q_splice_tail(bq->q, list, n);
+        if (bq->waiting_consumers)
+            pthread_cond_signal(&bq->has_elements);
+        /* Hand the room left over to the next producer */
+        if (bq->waiting_producers && has_room(bq))
+            pthread_cond_signal(&bq->has_room);
+    }
+    pthread_mutex_unlock(&bq->lock);
+    return ok;
+}
+
+int q_pop_blocking(bqueue_t *bq, struct list_head *out, int max, int timeout)
+{
+    if (max <= 0)
+        return 0;
+
+    struct timespec ts, *deadline = deadline_of(&ts, timeout);
+    pthread_mutex_lock(&bq->lock);
+    while (!bq->closed && !q_size(bq->q)) {
+        bq->waiting_consumers++;
+        bq->consumer_waits++;
+        bool more = wait_on(bq, &bq->has_elements, deadline);
+        bq->waiting_consumers--;
+        if (!more)
+            break;
+    }
+
+    int n = q_size(bq->q);
+    if (n <= max)
+        q_drain(bq->q, out);
+    else
+        n = q_remove_head_n(bq->q, max, out);
+    if (n) {
+        /* Hand the elements left over to the next consumer */
+        if (bq->waiting_consumers && q_size(bq->q))
+            pthread_cond_signal(&bq->has_elements);
+        if (bq->waiting_producers && has_room(bq))
+            pthread_cond_signal(&bq->has_room);
+    }
+    pthread_mutex_unlock(&bq->lock);
+    return n;
+}
+
+void bq_waits(bqueue_t *bq, long *producers, long *consumers)
+{
+    pthread_mutex_lock(&bq->lock);
+    *producers = bq->producer_waits;
+    *consumers = bq->consumer_waits;
+    pthread_mutex_unlock(&bq->lock);
+}
@@ -0,0 +1,80 @@
+#ifndef LAB0_BQUEUE_H
+#define LAB0_BQUEUE_H
+
+/* Blocking queue shared by threads, wrapping a queue from q_new().
+ *
+ * One mutex protects the queue. Producers and consumers move whole lists of
+ * elements, each with a single splice while holding the lock, so the lock is
+ * taken once per batch instead of once per element. A thread waits on a
+ * condition variable only when it cannot proceed: consumers when the queue is
+ * empty, producers when it is full. Wakeups are targeted: a batch wakes one
+ * waiting consumer, which wakes the next one if it leaves elements behind,
+ * and producers are woken the same way. Waiting threads are counted, so no
+ * signal is sent when nobody waits.
+ *
+ * Elements are created and released by the threads using the queue, which
+ * requires the harness allocator to be thread-safe.
+ */
+
+#include <stdbool.h>
+
+#include "queue.h"
+
+typedef struct bqueue bqueue_t;
+
+/**
+ * bq_new() - Create an empty blocking queue
+ * @capacity: number of elements above which producers wait, zero for none
+ *
+ * Return: NULL for allocation failed
+ */
+bqueue_t *bq_new(int capacity);
+
+/* Free a blocking queue no thread uses any more, with its elements */
+void bq_free(bqueue_t *bq);
+
+/**
+ * bq_close() - Stop accepting elements and wake every waiting thread
+ * @bq: the queue
+ *
+ * Consumers still get the elements left, then q_pop_blocking() returns zero.
+ */
+void bq_close(bqueue_t *bq);
+
+/**
+ * q_push_blocking() - Move a list of elements to the tail of a blocking queue
+ * @bq: the queue
+ * @list: elements to move, in order, left empty on success
+ * @n: number of elements in @list
+ * @timeout: milliseconds to wait for the queue to drop below its capacity,
+ *           negative to wait for as long as it takes
+ *
+ * The list goes in as a whole once there is room for one element, so that
+ * the queue may end up above its capacity by less than one batch.
+ *
+ * Return: false if the wait timed out or the queue is closed
+ */
+bool q_push_blocking(bqueue_t *bq, struct list_head *list, int n, int timeout);
+
+/**
+ * q_pop_blocking() - Move elements from the head of a blocking queue
+ * @bq: the queue
+ * @out: list the elements are appended to, in queue order
+ * @max: maximum number of elements to take
+ * @timeout: milliseconds to wait for an element, negative to wait for as long
+ *           as it takes
+ *
+ * Return: the number of elements moved, zero if the wait timed out or the
+ * queue is closed and empty
+ */
+int q_pop_blocking(bqueue_t *bq, struct list_head *out, int max, int timeout);
+
+/**
+ * bq_waits() - Number of times threads had to wait
+ * @bq: the queue
+ * @producers: set to the waits of producers for room
+ * @consumers: set to the waits of consumers for elements
+ */
+void bq_waits(bqueue_t *bq, long *producers, long *consumers);
+
+#endif /* LAB0_BQUEUE_H */
@@ -0,0 +1,9 @@
+#ifndef LAB0_CACHELINE_H
+#define LAB0_CACHELINE_H
+
+/* Indices written by different threads are kept this far apart, so that
+ * they never share a cache line
+ */
+#define CACHE_LINE 64
+
+#endif /* LAB0_CACHELINE_H */
@@ -0,0 +1,563 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "extsort.h"
+
+/* Size of the output buffer, and of the smallest input buffer of a merge */
+#define IO_BUF (64 << 10)
+
+/* Longest record: the string between two varints of at most 10 bytes */
+#define MAX_RECORD (EXTSORT_MAX_STRING + 20)
+
+/* Ranges sorted by insertion in sort_entries() */
+#define INSERTION_CUTOFF 16
+
+/**
+ * entry_t - String gathered for the current run
+ * @key: first 8 bytes of the string in big-endian order, zero padded
+ * @off: offset of its record in the buffer, which also gives the order the
+ *       strings came in
+ */
+typedef struct {
+    uint64_t key;
+    size_t off;
+} entry_t;
+
+/* Run in a temporary file, from byte @start to @end */
+typedef struct {
+    off_t start, end;
+} run_t;
+
+/**
+ * cursor_t - Position in a run being merged
+ * @pos: next byte of the run to read
+ * @end: end of the run
+ * @buf: input buffer, of @cap bytes
+ * @head: first byte of the current record in @buf
+ * @fill: end of the bytes read into @buf
+ * @size: length of the current record
+ * @s: string of the current record
+ * @len: length of @s
+ * @tag: tag of the current record
+ */
+typedef struct {
+    off_t pos, end;
+    char *buf;
+    size_t cap, head, fill, size;
+    const char *s;
+    size_t len;
+    uint64_t tag;
+} cursor_t;
+
+struct __extsort {
+    char *mem;     /* Buffer of the budget size */
+    size_t budget; /* Size of @mem */
+    bool error;    /* Some I/O failed, the sort is unusable */
+
+    /* Gathering: the output buffer starts @mem, records follow up to @top
+     * and @count entries end it
+     */
+    size_t top, count;
+
+    /* Temporary files. Runs are read from @file[@cur] and written to the
+     * end of @file[!@cur], at @wpos, through the output buffer.
+     */
+    FILE *file[2];
+    int cur;
+    off_t wpos;
+    size_t out;
+    run_t *runs; /* Runs of @file[@cur], and their number and room */
+    size_t nruns, room;
+    size_t written; /* Runs written so far */
+
+    /* Result: either the @count sorted entries, or a merge of @ncursor
+     * runs whose cursors are kept in a heap
+     */
+    bool merging;
+    size_t next; /* Next entry to return, or whether to advance the top */
+    cursor_t *cursor;
+    size_t *heap, ncursor, nheap;
+};
+
+static inline entry_t *entries(const extsort_t *ext)
+{
+    return (entry_t *) (ext->mem + ext->budget) - ext->count;
+}
+
+static size_t varint_put(char *p, uint64_t v)
+{
+    size_t n = 0;
+    for (; v >= 0x80; v >>= 7)
+        p[n++] = (char) (v | 0x80);
+    p[n++] = (char) v;
+    return n;
+}
+
+/* Decode a varint from @p, reading no further than @end. Return its length,
+ * zero if it is truncated or too long.
+ */
+static size_t varint_get(const char *p, const char *end, uint64_t *v)
+{
+    *v = 0;
+    for (size_t n = 0; n < 10 && p + n < end; n++) {
+        *v |= (uint64_t) (p[n] & 0x7f) << (7 * n);
+        if (!(p[n] & 0x80))
+            return n + 1;
+    }
+    return 0;
+}
+
+/* Decode the record at @p, no longer than @end - @p. Return its size, zero
+ * if it is truncated.
+ */
+static size_t record_get(const char *p,
+                         const char *end,
+                         const char **s,
+                         size_t *len,
+                         uint64_t *tag)
+{
+    uint64_t n;
+    size_t size = varint_get(p, end, &n);
+    if (!size || n > EXTSORT_MAX_STRING || (size_t) (end - p) < size + n)
+        return 0;
+    *s = p + size;
+    *len = n;
+    size += n;
+
+    size_t tag_size = varint_get(p + size, end, tag);
+    return tag_size ? size + tag_size : 0;
+}
+
+/* Compare two strings like strcmp() does, if neither held a zero byte */
+static int string_cmp(const char *a, size_t alen, const char *b, size_t blen)
+{
+    int cmp = memcmp(a, b, alen < blen ? alen : blen);
+    if (cmp)
+        return cmp;
+    return alen < blen ? -1 : alen > blen;
+}
+
+static int entry_cmp(const char *mem, const entry_t *a, const entry_t *b)
+{
+    if (a->key != b->key)
+        return a->key < b->key ? -1 : 1;
+
+    const char *as, *bs;
+    size_t alen, blen;
+    uint64_t tag;
+    record_get(mem + a->off, mem + a->off + MAX_RECORD, &as, &alen, &tag);
+    record_get(mem + b->off, mem + b->off + MAX_RECORD, &bs, &blen, &tag);
+    int cmp = string_cmp(as, alen, bs, blen);
+    if (cmp)
+        return cmp;
+
+    /* Equal strings keep the order they came in */
+    return a->off < b->off ? -1 : a->off > b->off;
+}
+
+static inline void entry_swap(entry_t *a, entry_t *b)
+{
+    entry_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+/* Quicksort on the median of three, in place. No two entries compare equal,
+ * so there is no need for a stable algorithm, nor for one which allocates.
+ */
+static void sort_entries(const char *mem, entry_t *a, size_t n)
+{
+    while (n > INSERTION_CUTOFF) {
+        entry_t *mid = a + n / 2, *last = a + n - 1;
+        if (entry_cmp(mem, mid, a) < 0)
+            entry_swap(mid, a);
+        if (entry_cmp(mem, last, mid) < 0) {
+            entry_swap(last, mid);
+            if (entry_cmp(mem, mid, a) < 0)
+                entry_swap(mid, a);
+        }
+
+        /* The first and last entries stop the scans */
+        entry_t pivot = *mid;
+        size_t i = 0, j = n - 1;
+        for (;;) {
+            while (entry_cmp(mem, &a[++i], &pivot) < 0)
+                ;
+            while (entry_cmp(mem, &pivot, &a[--j]) < 0)
+                ;
+            if (i >= j)
+                break;
+            entry_swap(&a[i], &a[j]);
+        }
+
+        /* Recurse into the smaller side, so the stack stays logarithmic */
+        if (i < n - i) {
+            sort_entries(mem, a, i);
+            a += i;
+            n -= i;
+        } else {
+            sort_entries(mem, a + i, n - i);
+            n = i;
+        }
+    }
+
+    for (size_t i = 1; i < n; i++) {
+        entry_t e = a[i];
+        size_t j = i;
+        for (; j && entry_cmp(mem, &e, &a[j - 1]) < 0; j--)
+            a[j] = a[j - 1];
+        a[j] = e;
+    }
+}
+
+static bool write_at(int fd, const char *buf, size_t n, off_t pos)
+{
+    while (n) {
+        ssize_t ret = pwrite(fd, buf, n, pos);
+        if (ret <= 0)
+            return false;
+        buf += ret;
+        n -= ret;
+        pos += ret;
+    }
+    return true;
+}
+
+/* Write the output buffer at the end of the file being written */
+static bool out_flush(extsort_t *ext)
+{
+    if (!write_at(fileno(ext->file[!ext->cur]), ext->mem, ext->out, ext->wpos))
+        return false;
+    ext->wpos += ext->out;
+    ext->out = 0;
+    return true;
+}
+
+static bool out_put(extsort_t *ext, const char *p, size_t n)
+{
+    if (ext->out + n > IO_BUF && !out_flush(ext))
+        return false;
+    memcpy(ext->mem + ext->out, p, n);
+    ext->out += n;
+    return true;
+}
+
+/* Start a run at the end of the file being written */
+static bool run_begin(extsort_t *ext)
+{
+    if (!ext->file[!ext->cur] && !(ext->file[!ext->cur] = tmpfile()))
+        return false;
+    ext->out = 0;
+    return true;
+}
+
+/* Flush the run begun at @start and record it in the table of the next pass,
+ * which is kept past the runs of this one
+ */
+static bool run_end(extsort_t *ext, off_t start, size_t *nout)
+{
+    if (!out_flush(ext))
+        return false;
+
+    size_t slot = ext->nruns + *nout;
+    if (slot == ext->room) {
+        size_t room = ext->room ? ext->room * 2 : 16;
+        run_t *runs = realloc(ext->runs, room * sizeof(run_t));
+        if (!runs)
+            return false;
+        ext->runs = runs;
+        ext->room = room;
+    }
+    ext->runs[slot] = (run_t){start, ext->wpos};
+    (*nout)++;
+    ext->written++;
+    return true;
+}
+
+/* Sort the gathered strings and spill them as a run */
+static bool spill(extsort_t *ext)
+{
+    entry_t *e = entries(ext);
+    sort_entries(ext->mem, e, ext->count);
+
+    off_t start = ext->wpos;
+    size_t nout = 0;
+    if (!run_begin(ext))
+        return false;
+    for (size_t i = 0; i < ext->count; i++) {
+        const char *p = ext->mem + e[i].off, *s;
+        size_t len;
+        uint64_t tag;
+        size_t size = record_get(p, p + MAX_RECORD, &s, &len, &tag);
+        if (!out_put(ext, p, size))
+            return false;
+    }
+    if (!run_end(ext, start, &nout))
+        return false;
+
+    ext->nruns += nout;
+    ext->top = IO_BUF;
+    ext->count = 0;
+    return true;
+}
+
+extsort_t *extsort_new(size_t budget)
+{
+    extsort_t *ext = calloc(1, sizeof(extsort_t));
+    if (!ext)
+        return NULL;
+
+    if (budget < EXTSORT_MIN_BUDGET)
+        budget = EXTSORT_MIN_BUDGET;
+    ext->budget = budget & ~(sizeof(entry_t) - 1);
+    ext->mem = malloc(ext->budget);
+    if (!ext->mem) {
+        free(ext);
+        return NULL;
+    }
+    ext->top = IO_BUF;
+    return ext;
+}
+
+bool extsort_add(extsort_t *ext, const char *s, size_t len, uint64_t tag)
+{
+    if (ext->error || len > EXTSORT_MAX_STRING)
+        return false;
+
+    size_t room = (char *) entries(ext) - ext->mem - sizeof(entry_t);
+    if (ext->top + len + 20 > room && !spill(ext)) {
+        ext->error = true;
+        return false;
+    }
+
+    entry_t *e = entries(ext) - 1;
+    e->off = ext->top;
+    e->key = 0;
+    for (size_t i = 0; i < 8 && i < len; i++)
+        e->key |= (uint64_t) (unsigned char) s[i] << (56 - 8 * i);
+    ext->count++;
+
+    char *p = ext->mem + ext->top;
+    size_t size = varint_put(p, len);
+    memcpy(p + size, s, len);
+    size += len;
+    size += varint_put(p + size, tag);
+    ext->top += size;
+    return true;
+}
+
+/* Make sure the current record of @c is whole in its buffer and decode it.
+ * Return false at the end of the run, or with @ext->error set on failure.
+ */
+static bool cursor_load(extsort_t *ext, cursor_t *c)
+{
+    if (c->fill - c->head < MAX_RECORD && c->pos < c->end) {
+        memmove(c->buf, c->buf + c->head, c->fill - c->head);
+        c->fill -= c->head;
+        c->head = 0;
+
+        size_t want = c->cap - c->fill;
+        if ((off_t) want > c->end - c->pos)
+            want = c->end - c->pos;
+        while (want) {
+            ssize_t ret = pread(fileno(ext->file[ext->cur]), c->buf + c->fill,
+                                want, c->pos);
+            if (ret <= 0) {
+                ext->error = true;
+                return false;
+            }
+            c->fill += ret;
+            c->pos += ret;
+            want -= ret;
+        }
+    }
+    if (c->head == c->fill)
+        return false;
+
+    c->size = record_get(c->buf + c->head, c->buf + c->fill, &c->s, &c->len,
+                         &c->tag);
+    if (!c->size) {
+        ext->error = true;
+        return false;
+    }
+    return true;
+}
+
+/* Whether the record of cursor @a goes before the one of @b. Runs come in
+ * the order of the strings they hold, so ties go to the lower cursor.
+ */
+static bool cursor_less(const extsort_t *ext, size_t a, size_t b)
+{
+    const cursor_t *ca = &ext->cursor[a], *cb = &ext->cursor[b];
+    int cmp = string_cmp(ca->s, ca->len, cb->s, cb->len);
+    return cmp < 0 || (!cmp && a < b);
+}
+
+static void heap_down(extsort_t *ext, size_t i)
+{
+    size_t *heap = ext->heap;
+    for (;;) {
+        size_t min = i, l = 2 * i + 1, r = l + 1;
+        if (l < ext->nheap && cursor_less(ext, heap[l], heap[min]))
+            min = l;
+        if (r < ext->nheap && cursor_less(ext, heap[r], heap[min]))
+            min = r;
+        if (min == i)
+            return;
+        size_t tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+}
+
+/* Start merging the @k runs from @runs, sharing the buffer past the output
+ * buffer among them
+ */
+static bool merge_open(extsort_t *ext, const run_t *runs, size_t k)
+{
+    size_t cap = (ext->budget - IO_BUF) / k;
+    ext->ncursor = ext->nheap = 0;
+    for (size_t i = 0; i < k; i++) {
+        cursor_t *c = &ext->cursor[i];
+        *c = (cursor_t){.pos = runs[i].start,
+                        .end = runs[i].end,
+                        .buf = ext->mem + IO_BUF + i * cap,
+                        .cap = cap};
+        ext->ncursor++;
+        if (cursor_load(ext, c))
+            ext->heap[ext->nheap++] = i;
+        else if (ext->error)
+            return false;
+    }
+    for (size_t i = ext->nheap / 2; i-- > 0;)
+        heap_down(ext, i);
+    return true;
+}
+
+/* Move past the record on top of the heap */
+static bool merge_advance(extsort_t *ext)
+{
+    cursor_t *c = &ext->cursor[ext->heap[0]];
+    c->head += c->size;
+    if (!cursor_load(ext, c)) {
+        if (ext->error)
+            return false;
+        ext->heap[0] = ext->heap[--ext->nheap];
+    }
+    heap_down(ext, 0);
+    return true;
+}
+
+bool extsort_finish(extsort_t *ext)
+{
+    if (ext->error)
+        return false;
+
+    /* Everything fits the buffer: no need for any file */
+    if (!ext->nruns) {
+        sort_entries(ext->mem, entries(ext), ext->count);
+        return true;
+    }
+    if (ext->count && !spill(ext)) {
+        ext->error = true;
+        return false;
+    }
+    ext->cur = !ext->cur;
+
+    size_t fan_in = (ext->budget - IO_BUF) / IO_BUF;
+    ext->cursor = malloc(fan_in * sizeof(cursor_t));
+    ext->heap = malloc(fan_in * sizeof(size_t));
+    if (!ext->cursor || !ext->heap) {
+        ext->error = true;
+        return false;
+    }
+
+    /* Merge groups of runs into the other file until one pass is enough.
+     * The runs of the next pass are recorded past the current ones.
+     */
+    while (ext->nruns > fan_in) {
+        size_t nout = 0;
+        ext->wpos = 0;
+        for (size_t i = 0; i < ext->nruns; i += fan_in) {
+            size_t k = ext->nruns - i < fan_in ? ext->nruns - i : fan_in;
+            off_t start = ext->wpos;
+            if (!run_begin(ext) || !merge_open(ext, &ext->runs[i], k))
+                goto fail;
+            while (ext->nheap) {
+                cursor_t *c = &ext->cursor[ext->heap[0]];
+                if (!out_put(ext, c->buf + c->head, c->size) ||
+                    !merge_advance(ext))
+                    goto fail;
+            }
+            if (!run_end(ext, start, &nout))
+                goto fail;
+        }
+
+        /* The file just read is written by the next pass */
+        memmove(ext->runs, ext->runs + ext->nruns, nout * sizeof(run_t));
+        ext->nruns = nout;
+        if (ftruncate(fileno(ext->file[ext->cur]), 0))
+            goto fail;
+        ext->cur = !ext->cur;
+    }
+
+    ext->merging = true;
+    if (!merge_open(ext, ext->runs, ext->nruns))
+        goto fail;
+    return true;
+
+fail:
+    ext->error = true;
+    return false;
+}
+
+bool extsort_next(extsort_t *ext, const char **s, size_t *len, uint64_t *tag)
+{
+    if (ext->error)
+        return false;
+
+    if (!ext->merging) {
+        if (ext->next == ext->count)
+            return false;
+        const char *p = ext->mem + entries(ext)[ext->next++].off;
+        record_get(p, p + MAX_RECORD, s, len, tag);
+        return true;
+    }
+
+    if (ext->next && !merge_advance(ext))
+        return false;
+    if (!ext->nheap)
+        return false;
+    ext->next = 1;
+
+    const cursor_t *c = &ext->cursor[ext->heap[0]];
+    *s = c->s;
+    *len = c->len;
+    *tag = c->tag;
+    return true;
+}
+
+size_t extsort_runs(const extsort_t *ext)
+{
+    return ext->written;
+}
+
+void extsort_free(extsort_t *ext)
+{
+    if (!ext)
+        return;
+
+    for (int i = 0; i < 2; i++) {
+        if (ext->file[i])
+            fclose(ext->file[i]);
+    }
+    free(ext->runs);
+    free(ext->cursor);
+    free(ext->heap);
+    free(ext->mem);
+    free(ext);
+}
@@ -0,0 +1,74 @@
+#ifndef LAB0_EXTSORT_H
+#define LAB0_EXTSORT_H
+
+/* External merge sort of strings under a memory budget.
+ *
+ * Strings are gathered in a buffer of the budget size. Whenever it is full,
+ * they are sorted and spilled as a run to a temporary file, in a compact
+ * format: the length of each string as a varint, its bytes, then a varint
+ * tag. The runs are then merged back, several passes being made if there
+ * are more of them than fit the budget at once, with large sequential reads
+ * and writes. Apart from a table of runs, no memory is used outside the
+ * buffer.
+ *
+ * The sort is stable, and every string carries a tag given back with it,
+ * which lets q_sort() relink the elements in the order of their strings.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Smallest budget accepted, smaller ones are rounded up to it */
+#define EXTSORT_MIN_BUDGET (256 << 10)
+
+/* Longest string accepted */
+#define EXTSORT_MAX_STRING (16 << 10)
+
+typedef struct __extsort extsort_t;
+
+/**
+ * extsort_new() - Start an external sort
+ * @budget: bytes of memory the sort may use
+ *
+ * Return: NULL for allocation failed
+ */
+extsort_t *extsort_new(size_t budget);
+
+/**
+ * extsort_add() - Add a string to sort
+ * @ext: the sort
+ * @s: string to add, which needs no terminator
+ * @len: length of @s
+ * @tag: value given back with @s
+ *
+ * Return: false if the string is too long or writing a run failed
+ */
+bool extsort_add(extsort_t *ext, const char *s, size_t len, uint64_t tag);
+
+/**
+ * extsort_finish() - Merge the runs until one pass can return the result
+ * @ext: the sort
+ *
+ * Return: false if writing or reading a run failed
+ */
+bool extsort_finish(extsort_t *ext);
+
+/**
+ * extsort_next() - Get the next string in ascending order
+ * @ext: the sort, finished by extsort_finish()
+ * @s: set to the string, which stays valid until the next call
+ * @len: set to the length of the string
+ * @tag: set to the tag added with the string
+ *
+ * Return: false after the last string or if reading a run failed
+ */
+bool extsort_next(extsort_t *ext, const char **s, size_t *len, uint64_t *tag);
+
+/* Number of runs written by the sort */
+size_t extsort_runs(const extsort_t *ext);
+
+/* Release the memory and temporary files of the sort */
+void extsort_free(extsort_t *ext);
+
+#endif /* LAB0_EXTSORT_H */
@@ -1,7 +1,10 @@
 /* Test support code */
 
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,26 +32,70 @@
 
 /* Data structures used by our code */
 
+struct __registry;
+
 /* Represent allocated blocks as doubly-linked list, with
  * next and prev pointers at beginning
  */
 typedef struct __block_element {
     struct __block_element *next, *prev;
     size_t payload_size;
-    size_t magic_header; /* Marker to see if block seems legitimate */
-    unsigned char payload[0];
+    size_t magic_header;      /* Marker to see if block seems legitimate */
+    struct __registry *owner; /* Registry whose list holds the block */
+    struct __block_element *freed_next; /* Once freed by another thread */
+    unsigned char payload[0] __attribute__((aligned(16)));
     /* Also place magic number at tail of every block */
 } block_element_t;
 
-static block_element_t *allocated = NULL;
-static size_t allocated_count = 0;
+/* Blocks allocated by one thread. Only the thread holding the registry
+ * touches its list, with no lock. Another thread freeing one of its blocks
+ * counts it off in @freed and pushes it on @remote, from which the holder
+ * unlinks and frees it a few at a time. The live blocks number @count minus
+ * @freed; @count is only written by the holder, so it costs plain stores.
+ *
+ * The holder is the thread which allocated the blocks, unless it lent them
+ * with test_lend(). The registry then goes to the thread calling
+ * test_borrow(), until test_give_back() returns it to @lender.
+ */
+typedef struct __registry {
+    block_element_t *allocated;
+    block_element_t *draining; /* Taken from @remote, not unlinked yet */
+    _Atomic(block_element_t *) remote;
+    atomic_size_t count;
+    atomic_size_t freed;
+    _Atomic(const void *) holder; /* Tag of the holding thread, or LENT */
+    const void *lender;           /* Tag of the thread which lent it */
+    struct __registry *next;      /* In the list of all registries */
+    atomic_bool in_use;           /* Held, lent, or home of a thread */
+} registry_t;
+
+/* Blocks freed by other threads which a thread unlinks on each of its own
+ * allocations and frees, so that it never stalls on a long stack of them
+ */
+#define DRAIN_BATCH 4
+
+/* Every registry ever created. Registries are only ever added, and those of
+ * threads which have exited are taken over by new threads.
+ */
+static _Atomic(registry_t *) registries = NULL;
+
+/* Registry the thread allocates into, its home */
+static __thread registry_t *local_registry = NULL;
+
+/* Its address tells the threads apart in the holder of a registry */
+static __thread char thread_tag;
 
+/* Holder of a registry lent and not borrowed yet */
+static const char lent_tag;
+#define LENT ((const void *) &lent_tag)
+static pthread_key_t registry_key;
+static pthread_once_t registry_once = PTHREAD_ONCE_INIT;
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
 static bool cautious_mode = true;
 static bool noallocate_mode = false;
-static bool error_occurred = false;
+static atomic_bool error_occurred = false;
 static char *error_message = "";
 
 static int time_limit = 1;
@@ -58,19 +105,160 @@ static jmp_buf env;
 static volatile sig_atomic_t jmp_ready = false;
 static bool time_limited = false;
 
+/* Nonzero while the thread is inside malloc(), free() or updating its
+ * registry. An exception raised then by the alarm is held back until it
+ * leaves, since jumping away would leave the heap or the list half updated
+ * and hang or crash the next allocation.
+ */
+static __thread volatile sig_atomic_t held_depth = 0;
+static volatile sig_atomic_t exception_held = false;
+
 /* Internal functions */
 
 /* Should this allocation fail? */
 static bool fail_allocation()
 {
+    /* random() takes a lock shared by all threads */
+    if (!fail_probability)
+        return false;
     double weight = (double) random() / RAND_MAX;
     return (weight < 0.01 * fail_probability);
 }
 
+static void exceptions_hold(void)
+{
+    held_depth++;
+}
+
+/* Raise the exception held back since the outermost exceptions_hold() */
+static void exceptions_release(void)
+{
+    if (!--held_depth && exception_held) {
+        exception_held = false;
+        trigger_exception(error_message);
+    }
+}
+
+/* Add @delta to a counter only the calling thread writes */
+static void count_add(atomic_size_t *count, size_t delta)
+{
+    size_t n = atomic_load_explicit(count, memory_order_relaxed);
+    atomic_store_explicit(count, n + delta, memory_order_relaxed);
+}
+
+static void unlink_block(registry_t *r, block_element_t *b)
+{
+    block_element_t *bn = b->next;
+    block_element_t *bp = b->prev;
+    if (bp)
+        bp->next = bn;
+    else
+        r->allocated = bn;
+    if (bn)
+        bn->prev = bp;
+}
+
+/* Whether the calling thread holds @r, and frees its blocks as its own */
+static bool holds(registry_t *r)
+{
+    return atomic_load_explicit(&r->holder, memory_order_acquire) ==
+           &thread_tag;
+}
+
+/* Unlink and free up to @max of the blocks which other threads freed for @r,
+ * a registry the calling thread holds
+ */
+static void registry_drain(registry_t *r, size_t max)
+{
+    if (!r->draining &&
+        atomic_load_explicit(&r->remote, memory_order_relaxed))
+        r->draining =
+            atomic_exchange_explicit(&r->remote, NULL, memory_order_acquire);
+    for (size_t i = 0; i < max && r->draining; i++) {
+        block_element_t *b = r->draining;
+        r->draining = b->freed_next;
+        unlink_block(r, b);
+        free(b);
+    }
+}
+
+/* The thread has exited, its registry is up for grabs */
+static void registry_release(void *arg)
+{
+    registry_t *r = arg;
+    atomic_store(&r->holder, NULL);
+    atomic_store(&r->in_use, false);
+}
+
+static void registry_key_init(void)
+{
+    pthread_key_create(&registry_key, registry_release);
+}
+
+/* Registry of the calling thread, taken over from an exited thread or added
+ * on its first allocation
+ */
+static registry_t *registry_of_thread(void)
+{
+    if (local_registry)
+        return local_registry;
+    pthread_once(&registry_once, registry_key_init);
+
+    registry_t *r;
+    for (r = atomic_load(&registries); r; r = r->next) {
+        bool used = false;
+        if (atomic_compare_exchange_strong(&r->in_use, &used, true)) {
+            atomic_store(&r->holder, &thread_tag);
+            break;
+        }
+    }
+    if (!r) {
+        r = malloc(sizeof(registry_t));
+        if (!r)
+            report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        r->allocated = r->draining = NULL;
+        atomic_init(&r->remote, NULL);
+        atomic_init(&r->count, 0);
+        atomic_init(&r->freed, 0);
+        atomic_init(&r->holder, &thread_tag);
+        r->lender = NULL;
+        atomic_init(&r->in_use, true);
+        r->next = atomic_load(&registries);
+        while (!atomic_compare_exchange_weak(&registries, &r->next, r))
+            ;
+    }
+    pthread_setspecific(registry_key, r);
+    local_registry = r;
+    return r;
+}
+
+/* Whether @b is an allocated block. Lists are only walked by the threads
+ * owning them, so a block of another thread is only checked to name one of
+ * the registries. The walk only reads the list, so the alarm may cut it
+ * short; blocks other threads freed are still linked and found, but their
+ * header already says they are freed.
+ */
+static bool registered(const block_element_t *b)
+{
+    registry_t *own = b->owner;
+    if (own && holds(own)) {
+        for (block_element_t *ab = own->allocated; ab; ab = ab->next) {
+            if (ab == b)
+                return true;
+        }
+        return false;
+    }
+    for (registry_t *r = atomic_load(&registries); r; r = r->next) {
+        if (r == b->owner)
+            return true;
+    }
+    return false;
+}
+
 /* Find header of block, given its payload.
  * Signal error if doesn't seem like legitimate block
  */
-static block_element_t *find_header(void *p)
+static block_element_t *find_header(void *p, bool cautious)
 {
     if (!p) {
         report_event(MSG_ERROR, "Attempting to free null block");
@@ -79,15 +267,9 @@ static block_element_t *find_header(void *p)
 
     block_element_t *b =
         (block_element_t *) ((size_t) p - sizeof(block_element_t));
-    if (cautious_mode) {
+    if (cautious) {
         /* Make sure this is really an allocated block */
-        block_element_t *ab = allocated;
-        bool found = false;
-        while (ab && !found) {
-            found = ab == b;
-            ab = ab->next;
-        }
-        if (!found) {
+        if (!registered(b)) {
             report_event(MSG_ERROR,
                          "Attempted to free unallocated block.  Address = %p",
                          p);
@@ -129,6 +311,7 @@ void *test_malloc(size_t size)
         return NULL;
     }
 
+    exceptions_hold();
     block_element_t *new_block =
         malloc(size + sizeof(block_element_t) + sizeof(size_t));
     if (!new_block) {
@@ -143,15 +326,20 @@ void *test_malloc(size_t size)
     *find_footer(new_block) = MAGICFOOTER;
     void *p = (void *) &new_block->payload;
     memset(p, FILLCHAR, size);
+    registry_t *r = registry_of_thread();
+    registry_drain(r, DRAIN_BATCH);
+    // cppcheck-suppress nullPointerRedundantCheck
+    new_block->owner = r;
     // cppcheck-suppress nullPointerRedundantCheck
-    new_block->next = allocated;
+    new_block->next = r->allocated;
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->prev = NULL;
 
-    if (allocated)
-        allocated->prev = new_block;
-    allocated = new_block;
-    allocated_count++;
+    if (r->allocated)
+        r->allocated->prev = new_block;
+    r->allocated = new_block;
+    count_add(&r->count, 1);
+    exceptions_release();
 
     return p;
 }
@@ -168,17 +356,9 @@ void *test_calloc(size_t nelem, size_t elsize)
     return ptr;
 }
 
-void test_free(void *p)
+static void release_block(void *p, bool cautious)
 {
-    if (noallocate_mode) {
-        report_event(MSG_FATAL, "Calls to free disallowed");
-        return;
-    }
-
-    if (!p)
-        return;
-
-    block_element_t *b = find_header(p);
+    block_element_t *b = find_header(p, cautious);
     size_t footer = *find_footer(b);
     if (footer != MAGICFOOTER) {
         report_event(MSG_ERROR,
@@ -189,20 +369,92 @@ void test_free(void *p)
     }
     b->magic_header = MAGICFREE;
     *find_footer(b) = MAGICFREE;
+
     memset(p, FILLCHAR, b->payload_size);
 
-    /* Unlink from list */
-    block_element_t *bn = b->next;
-    block_element_t *bp = b->prev;
-    if (bp)
-        bp->next = bn;
-    else
-        allocated = bn;
-    if (bn)
-        bn->prev = bp;
+    /* Unlink from list, or leave that to the thread holding it */
+    registry_t *r = b->owner;
+    exceptions_hold();
+    if (holds(r)) {
+        unlink_block(r, b);
+        count_add(&r->count, -1);
+        free(b);
+        registry_drain(r, DRAIN_BATCH);
+    } else {
+        atomic_fetch_add_explicit(&r->freed, 1, memory_order_relaxed);
+        b->freed_next = atomic_load_explicit(&r->remote, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(
+            &r->remote, &b->freed_next, b, memory_order_release,
+            memory_order_relaxed))
+            ;
+    }
+    exceptions_release();
+}
+
+void test_free(void *p)
+{
+    if (noallocate_mode) {
+        report_event(MSG_FATAL, "Calls to free disallowed");
+        return;
+    }
+
+    if (p)
+        release_block(p, cautious_mode);
+}
+
+/* Looking every block up among all the others would make the reclaimer
+ * quadratic, so only the magic numbers are checked
+ */
+void test_free_deferred(void *p)
+{
+    if (p)
+        release_block(p, false);
+}
 
-    free(b);
-    allocated_count--;
+void test_lend(void)
+{
+    exceptions_hold();
+    for (registry_t *r = atomic_load(&registries); r; r = r->next) {
+        if (!holds(r))
+            continue;
+        r->lender = &thread_tag;
+        atomic_store_explicit(&r->holder, LENT, memory_order_release);
+    }
+
+    /* The next allocation takes another home */
+    if (local_registry) {
+        pthread_setspecific(registry_key, NULL);
+        local_registry = NULL;
+    }
+    exceptions_release();
+}
+
+void test_borrow(void)
+{
+    for (registry_t *r = atomic_load(&registries); r; r = r->next) {
+        const void *lent = LENT;
+        atomic_compare_exchange_strong_explicit(&r->holder, &lent, &thread_tag,
+                                                memory_order_acquire,
+                                                memory_order_relaxed);
+    }
+}
+
+void test_give_back(void)
+{
+    for (registry_t *r = atomic_load(&registries); r; r = r->next) {
+        if (r == local_registry || !holds(r))
+            continue;
+
+        /* An emptied registry is left for any thread to take as its home */
+        registry_drain(r, SIZE_MAX);
+        if (r->allocated) {
+            atomic_store_explicit(&r->holder, r->lender,
+                                  memory_order_release);
+        } else {
+            atomic_store(&r->holder, NULL);
+            atomic_store(&r->in_use, false);
+        }
+    }
 }
 
 // cppcheck-suppress unusedFunction
@@ -218,7 +470,16 @@ char *test_strdup(const char *s)
 
 size_t allocation_check()
 {
-    return allocated_count;
+    /* Blocks freed by another thread than their own are counted off the
+     * registry of the thread which allocated them, so the sum is exact once
+     * the threads are done
+     */
+    size_t count = 0;
+    for (registry_t *r = atomic_load(&registries); r; r = r->next) {
+        size_t freed = atomic_load(&r->freed);
+        count += atomic_load(&r->count) - freed;
+    }
+    return count;
 }
 
 /* Implementation of functions for testing */
@@ -242,9 +503,7 @@ void set_noallocate_mode(bool noallocate)
 /* Return whether any errors have occurred since last time set error limit */
 bool error_check()
 {
-    bool e = error_occurred;
-    error_occurred = false;
-    return e;
+    return atomic_exchange(&error_occurred, false);
 }
 
 /* Prepare for a risky operation using setjmp.
@@ -292,6 +551,10 @@ void trigger_exception(char *msg)
 {
     error_occurred = true;
     error_message = msg;
+    if (held_depth) {
+        exception_held = true;
+        return;
+    }
     if (jmp_ready)
         siglongjmp(env, 1);
     else
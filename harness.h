@@ -8,12 +8,39 @@
 /* This test harness enables us to do stringent testing of code.
  * It overloads the library versions of malloc and free with ones that
  * allow checking for common allocation errors.
+ *
+ * The allocation functions, allocation_check() and error_check() may be
+ * called from several threads at once. Each thread links the blocks it
+ * allocates in a list of its own, which no other thread walks or locks; a
+ * block freed by another thread is handed back to its owner through a
+ * lock-free stack. A thread about to free many blocks of another borrows its
+ * lists instead, see test_lend(). The other functions belong to the thread
+ * running the tests.
  */
 
 void *test_malloc(size_t size);
 void *test_calloc(size_t nmemb, size_t size);
 void test_free(void *p);
 char *test_strdup(const char *s);
+
+/* Free a block on behalf of an earlier command, as the reclaimer thread of
+ * reclaim.h does. Neither the restricted allocation mode of the running
+ * command nor cautious mode apply.
+ */
+void test_free_deferred(void *p);
+
+/* Lend the lists of blocks the calling thread holds, for another thread to
+ * free many of them without pushing each back. The calling thread allocates
+ * into a new list from then on, and frees the lent blocks as any other
+ * thread would.
+ */
+void test_lend(void);
+
+/* Hold every list lent so far, unlinking and freeing its blocks directly */
+void test_borrow(void);
+
+/* Give the lists taken by test_borrow() back to the threads which lent them */
+void test_give_back(void);
 /* FIXME: provide test_realloc as well */
 
 #ifdef INTERNAL
@@ -0,0 +1,122 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+#include "queue.h"
+
+/* Buckets allocated for the first string */
+#define INTERN_MIN_BUCKETS 64
+
+/**
+ * intern_t - Shared copy of a string
+ * @next: next copy in the same bucket
+ * @hash: hash of @str, kept to unlink and rehash without reading @str
+ * @ref: number of elements holding @str
+ * @str: the string itself
+ */
+typedef struct __intern {
+    struct __intern *next;
+    uint64_t hash;
+    size_t ref;
+    char str[];
+} intern_t;
+
+static struct {
+    intern_t **bucket; /* NULL while no string is interned */
+    size_t mask;       /* Number of buckets minus one */
+    size_t count;      /* Number of distinct strings */
+} table;
+
+/* FNV-1a hash of @s, also returning its length through @len */
+static uint64_t hash_of(const char *s, size_t *len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    const char *p = s;
+    for (; *p; p++)
+        h = (h ^ (unsigned char) *p) * 0x100000001b3ULL;
+    *len = p - s;
+    return h;
+}
+
+/* Double the number of buckets. On failure the chains just grow longer */
+static void table_grow(void)
+{
+    size_t size = (table.mask + 1) << 1;
+    intern_t **bucket = malloc(sizeof(intern_t *) * size);
+    if (!bucket)
+        return;
+    memset(bucket, 0, sizeof(intern_t *) * size);
+
+    for (size_t i = 0; i <= table.mask; i++) {
+        intern_t *in = table.bucket[i];
+        while (in) {
+            intern_t *next = in->next;
+            in->next = bucket[in->hash & (size - 1)];
+            bucket[in->hash & (size - 1)] = in;
+            in = next;
+        }
+    }
+    free(table.bucket);
+    table.bucket = bucket;
+    table.mask = size - 1;
+}
+
+char *intern_get(const char *s)
+{
+    size_t len;
+    uint64_t hash = hash_of(s, &len);
+
+    if (!table.bucket) {
+        table.bucket = malloc(sizeof(intern_t *) * INTERN_MIN_BUCKETS);
+        if (!table.bucket)
+            return NULL;
+        memset(table.bucket, 0, sizeof(intern_t *) * INTERN_MIN_BUCKETS);
+        table.mask = INTERN_MIN_BUCKETS - 1;
+    }
+
+    intern_t **pos = &table.bucket[hash & table.mask];
+    for (intern_t *in = *pos; in; in = in->next) {
+        if (in->hash == hash && !strcmp(in->str, s)) {
+            in->ref++;
+            return in->str;
+        }
+    }
+
+    intern_t *in = malloc(sizeof(intern_t) + len + 1);
+    if (!in) {
+        /* Do not leave an empty table behind the failed insertion */
+        if (!table.count) {
+            free(table.bucket);
+            table.bucket = NULL;
+        }
+        return NULL;
+    }
+    memcpy(in->str, s, len + 1);
+    in->hash = hash;
+    in->ref = 1;
+    in->next = *pos;
+    *pos = in;
+
+    if (++table.count > table.mask)
+        table_grow();
+    return in->str;
+}
+
+void intern_put(char *s)
+{
+    intern_t *in = (intern_t *) (s - offsetof(intern_t, str));
+    if (--in->ref)
+        return;
+
+    intern_t **pos = &table.bucket[in->hash & table.mask];
+    while (*pos != in)
+        pos = &(*pos)->next;
+    *pos = in->next;
+    free(in);
+
+    if (!--table.count) {
+        free(table.bucket);
+        table.bucket = NULL;
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef LAB0_INTERN_H
+#define LAB0_INTERN_H
+
+/* Interned string storage for the queue.
+ *
+ * Equal strings are stored once, in a hash table shared by all queues, and
+ * every element_t holding that content points to the same immutable copy.
+ * A copy carries a reference count and is freed, through the harness, when
+ * the last element holding it is released. The table itself is freed when it
+ * becomes empty, so a test with no queue left sees no allocated block.
+ *
+ * Since equal strings have equal addresses, elements can be compared for
+ * equality by their value pointers.
+ *
+ * Enabled with "make INTERN=1", with any backend.
+ */
+
+/**
+ * intern_get() - Take a reference to the shared copy of a string
+ * @s: string to look up, copied into the table if not present yet
+ *
+ * Return: the shared copy, NULL for allocation failed
+ */
+char *intern_get(const char *s);
+
+/**
+ * intern_put() - Drop a reference taken by intern_get()
+ * @s: shared copy returned by intern_get()
+ */
+void intern_put(char *s);
+
+#endif /* LAB0_INTERN_H */
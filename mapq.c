@@ -0,0 +1,134 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapq.h"
+
+/**
+ * mapping_t - Mapped file and the elements of its lines
+ * @list: node in the list of mappings
+ * @map: the file contents, followed by at least one zero byte, read-only
+ * @len: length of @map
+ * @live: number of elements not released yet
+ * @n: number of elements, one per line
+ * @elems: the elements
+ */
+typedef struct {
+    struct list_head list;
+    char *map;
+    size_t len;
+    size_t live;
+    size_t n;
+    element_t elems[];
+} mapping_t;
+
+static LIST_HEAD(mappings);
+int mapq_files = 0;
+
+/* Map @size bytes of @fd, followed by a zero byte even when the file ends on
+ * a page boundary, so that the last line ends even without a newline
+ */
+static char *map_file(int fd, size_t size, size_t *len)
+{
+    *len = size + 1;
+    char *map =
+        mmap(NULL, *len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    if (size && mmap(map, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd,
+                     0) == MAP_FAILED) {
+        int err = errno;
+        munmap(map, *len);
+        errno = err;
+        return NULL;
+    }
+    madvise(map, *len, MADV_SEQUENTIAL);
+    return map;
+}
+
+bool mapq_load(struct list_head *head, const char *path, int *count)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return false;
+    }
+
+    size_t len;
+    char *map = map_file(fd, st.st_size, &len);
+    close(fd);
+    if (!map)
+        return false;
+
+    /* Count the lines first, so that their elements take a single block */
+    char *end = map + st.st_size;
+    size_t n = 0;
+    for (char *p = map; p < end;) {
+        char *nl = memchr(p, '\n', end - p);
+        if (!nl)
+            nl = end;
+        n += nl != p;
+        p = nl + 1;
+    }
+
+    if (!n) {
+        munmap(map, len);
+        return true;
+    }
+    mapping_t *m = NULL;
+    if (n > (size_t) (INT_MAX - *count))
+        errno = EFBIG;
+    else if (!(m = malloc(sizeof(mapping_t) + n * sizeof(element_t))))
+        errno = ENOMEM;
+    if (!m) {
+        int err = errno;
+        munmap(map, len);
+        errno = err;
+        return false;
+    }
+    m->map = map;
+    m->len = len;
+    m->live = n;
+    m->n = n;
+    list_add(&m->list, &mappings);
+    mapq_files++;
+
+    size_t i = 0;
+    for (char *p = map; p < end;) {
+        char *nl = memchr(p, '\n', end - p);
+        if (!nl)
+            nl = end;
+        if (nl != p) {
+            m->elems[i].value = p;
+            m->elems[i].mapped = true;
+            q_adopt_tail(head, &m->elems[i++]);
+        }
+        p = nl + 1;
+    }
+    *count += n;
+    return true;
+}
+
+void mapq_release(element_t *e)
+{
+    mapping_t *m;
+    list_for_each_entry (m, &mappings, list) {
+        if (e < m->elems || e >= m->elems + m->n)
+            continue;
+        if (--m->live)
+            return;
+        list_del(&m->list);
+        mapq_files--;
+        munmap(m->map, m->len);
+        free(m);
+        return;
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef LAB0_MAPQ_H
+#define LAB0_MAPQ_H
+
+/* Queues mapped from text files, behind the mapq command of qtest.
+ *
+ * A file is mapped read-only and each of its lines becomes an element whose
+ * value points into the mapping and ends at the newline, which element_len()
+ * and element_cmp() of sort.h treat as the terminator of the elements marked
+ * mapped. Empty lines are skipped, as queues
+ * hold no empty strings. The elements of a file are carved out of one block,
+ * so loading a corpus allocates nothing per line and costs the page faults of
+ * the mapping, whose pages stay shared with the page cache. Strings are never
+ * written once they are in a queue, so no operation has to copy them.
+ *
+ * A mapping lives until the last of its elements is released, from whichever
+ * queue it ended up in. q_release_element() hands elements marked mapped to
+ * mapq_release() instead of freeing them.
+ */
+
+#include <stdbool.h>
+
+#include "queue.h"
+
+/**
+ * mapq_load() - Append the lines of a text file to a queue
+ * @head: queue the lines are linked in at the tail of
+ * @path: file to map
+ * @count: incremented by the number of lines linked in
+ *
+ * Return: false with errno set if the file could not be mapped or the block
+ * of elements allocated. Nothing is linked in then.
+ */
+bool mapq_load(struct list_head *head, const char *path, int *count);
+
+/**
+ * mapq_release() - Give back an element of a mapped file
+ * @e: element marked mapped
+ *
+ * The file is unmapped along with its last element.
+ */
+void mapq_release(element_t *e);
+
+/* Number of files still mapped. Releasing their elements is not thread-safe,
+ * so q_free() keeps the reclaimer of reclaim.h out while any is.
+ */
+extern int mapq_files;
+
+#endif /* LAB0_MAPQ_H */
@@ -0,0 +1,113 @@
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "cacheline.h"
+#include "mpmc.h"
+
+/**
+ * cell_t - Slot of the ring
+ * @seq: position the cell is ready to be inserted at, or that plus one once
+ *       it holds the element inserted there
+ * @e: the element
+ */
+typedef struct {
+    atomic_size_t seq;
+    element_t *e;
+} cell_t;
+
+/* Producers only write @tail and consumers only @head, each on its own line,
+ * away from the fields every thread reads
+ */
+struct mpmc {
+    cell_t *cell;
+    size_t mask;
+    char pad0[CACHE_LINE - sizeof(cell_t *) - sizeof(size_t)];
+    atomic_size_t tail;
+    char pad1[CACHE_LINE - sizeof(atomic_size_t)];
+    atomic_size_t head;
+    char pad2[CACHE_LINE - sizeof(atomic_size_t)];
+};
+
+mpmc_t *mpmc_new(size_t capacity)
+{
+    size_t cap = 2;
+    while (cap < capacity)
+        cap <<= 1;
+
+    mpmc_t *q = malloc(sizeof(mpmc_t));
+    if (!q)
+        return NULL;
+    q->cell = malloc(cap * sizeof(cell_t));
+    if (!q->cell) {
+        free(q);
+        return NULL;
+    }
+    for (size_t i = 0; i < cap; i++)
+        atomic_init(&q->cell[i].seq, i);
+    q->mask = cap - 1;
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->head, 0);
+    return q;
+}
+
+void mpmc_free(mpmc_t *q)
+{
+    if (!q)
+        return;
+    free(q->cell);
+    free(q);
+}
+
+bool mpmc_insert_tail(mpmc_t *q, element_t *e)
+{
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    for (;;) {
+        cell_t *c = &q->cell[pos & q->mask];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+        if (!diff) {
+            /* The cell is free for this lap. On failure pos is reloaded */
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            /* Still holds the element inserted one lap ago */
+            return false;
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+
+    cell_t *c = &q->cell[pos & q->mask];
+    c->e = e;
+    atomic_store_explicit(&c->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+element_t *mpmc_remove_head(mpmc_t *q)
+{
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    for (;;) {
+        cell_t *c = &q->cell[pos & q->mask];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+        if (!diff) {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            /* Nothing was inserted at this position yet */
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+
+    cell_t *c = &q->cell[pos & q->mask];
+    element_t *e = c->e;
+    /* Hand the cell over to the insertion one lap ahead */
+    atomic_store_explicit(&c->seq, pos + q->mask + 1, memory_order_release);
+    return e;
+}
@@ -0,0 +1,56 @@
+#ifndef LAB0_MPMC_H
+#define LAB0_MPMC_H
+
+/* Bounded lock-free queue of elements for many producers and consumers.
+ *
+ * The queue is a ring of cells, each carrying a sequence number which tells
+ * the lap of the ring the cell is ready for (D. Vyukov's bounded MPMC queue).
+ * A thread claims a position with a compare-and-swap on the tail or head
+ * index, then publishes through the sequence number of the cell, so no
+ * operation takes a lock and a thread stalled in the middle of one only holds
+ * up the cell it claimed.
+ *
+ * Only pointers to elements are stored, and the queue never dereferences
+ * them. An element removed and released by one thread is therefore never
+ * touched by another, and no hazard pointers or epochs are needed to reclaim
+ * it.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+typedef struct mpmc mpmc_t;
+
+/**
+ * mpmc_new() - Create an empty queue
+ * @capacity: number of elements it can hold, rounded up to a power of two
+ *
+ * Return: NULL for allocation failed
+ */
+mpmc_t *mpmc_new(size_t capacity);
+
+/* Free a queue, which no thread may use any more. Elements are left alone */
+void mpmc_free(mpmc_t *q);
+
+/**
+ * mpmc_insert_tail() - Insert an element at the tail, from any thread
+ * @q: the queue
+ * @e: element to insert, owned by the queue until removed
+ *
+ * Return: false if the queue is full
+ */
+bool mpmc_insert_tail(mpmc_t *q, element_t *e);
+
+/**
+ * mpmc_remove_head() - Remove the element at the head, from any thread
+ * @q: the queue
+ *
+ * Elements inserted by one thread are removed in the order it inserted them.
+ *
+ * Return: the element, now owned by the caller, NULL if the queue is empty
+ */
+element_t *mpmc_remove_head(mpmc_t *q);
+
+#endif /* LAB0_MPMC_H */
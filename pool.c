@@ -0,0 +1,332 @@
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "cacheline.h"
+#include "pool.h"
+
+/* Tasks a deque holds. A round pushing more runs the rest right away */
+#define DEQUE_SIZE 256
+
+/* Times a worker looks for work in vain before going to sleep */
+#define POOL_SPINS 64
+
+/**
+ * deque_t - Chase-Lev deque of tasks
+ * @top: next position to steal from, advanced by any thread
+ * @bottom: next position to push at, only written by the owner
+ * @task: ring of tasks between @top and @bottom
+ */
+typedef struct {
+    atomic_long top;
+    char pad0[CACHE_LINE - sizeof(atomic_long)];
+    atomic_long bottom;
+    char pad1[CACHE_LINE - sizeof(atomic_long)];
+    _Atomic(pool_task_t *) task[DEQUE_SIZE];
+} deque_t;
+
+/**
+ * worker_t - Thread of the pool
+ * @deque: tasks pushed by the thread
+ * @tid: the thread, unused for the first one, which calls pool_run()
+ * @index: position in the pool
+ * @tasks: see pool_stats_t
+ * @steals: see pool_stats_t
+ * @idle: see pool_stats_t
+ */
+typedef struct {
+    deque_t deque;
+    pthread_t tid;
+    int index;
+    atomic_long tasks;
+    atomic_long steals;
+    atomic_long idle;
+} worker_t;
+
+/**
+ * pool - The pool
+ * @workers: one per thread, NULL while not started
+ * @threads: number of @workers
+ * @started: workers whose thread is running, the first one included
+ * @caller_busy: a thread outside of the pool is running a round, as the
+ *               owner of the first worker
+ * @stop: the workers have to exit
+ * @lock: guards going to sleep and waking up
+ * @wake: idle workers sleep on it
+ * @epoch: bumped with @lock held whenever tasks are pushed
+ * @sleepers: workers waiting on @wake
+ */
+static struct {
+    worker_t *workers;
+    int threads;
+    int started;
+    atomic_bool caller_busy;
+    atomic_bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    atomic_long epoch;
+    int sleepers;
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+int pool_threads = 1;
+
+/* Worker of the calling thread, NULL outside of the pool and of a round */
+static __thread worker_t *self = NULL;
+
+/* Push a task at the bottom of the deque of the calling thread */
+static bool deque_push(deque_t *d, pool_task_t *t)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&d->top, memory_order_acquire);
+    if (b - top >= DEQUE_SIZE)
+        return false;
+    atomic_store_explicit(&d->task[b % DEQUE_SIZE], t, memory_order_relaxed);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_release);
+    return true;
+}
+
+/* Take the task at the bottom of the deque of the calling thread */
+static pool_task_t *deque_take(deque_t *d)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_seq_cst);
+    long top = atomic_load_explicit(&d->top, memory_order_seq_cst);
+    if (top > b) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    pool_task_t *t =
+        atomic_load_explicit(&d->task[b % DEQUE_SIZE], memory_order_relaxed);
+    if (top == b) {
+        /* Last task: race the thieves for it */
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+                                                     memory_order_seq_cst,
+                                                     memory_order_relaxed))
+            t = NULL;
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return t;
+}
+
+/* Take the task at the top of the deque of another thread */
+static pool_task_t *deque_steal(deque_t *d)
+{
+    long top = atomic_load_explicit(&d->top, memory_order_seq_cst);
+    long b = atomic_load_explicit(&d->bottom, memory_order_seq_cst);
+    if (top >= b)
+        return NULL;
+
+    pool_task_t *t =
+        atomic_load_explicit(&d->task[top % DEQUE_SIZE], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed))
+        return NULL;
+    return t;
+}
+
+static inline void count(atomic_long *counter)
+{
+    atomic_store_explicit(
+        counter, atomic_load_explicit(counter, memory_order_relaxed) + 1,
+        memory_order_relaxed);
+}
+
+static void run_task(worker_t *w, pool_task_t *t)
+{
+    /* The task is gone once the round sees it done */
+    atomic_int *pending = t->pending;
+    t->func(t->arg);
+    count(&w->tasks);
+    atomic_fetch_sub_explicit(pending, 1, memory_order_release);
+}
+
+/* A task from the deque of @w, or else stolen from another one */
+static pool_task_t *find_task(worker_t *w)
+{
+    pool_task_t *t = deque_take(&w->deque);
+    if (t)
+        return t;
+    for (int i = 1; i < pool.threads; i++) {
+        t = deque_steal(&pool.workers[(w->index + i) % pool.threads].deque);
+        if (t) {
+            count(&w->steals);
+            return t;
+        }
+    }
+    return NULL;
+}
+
+static void *worker_main(void *arg)
+{
+    worker_t *w = arg;
+    self = w;
+
+    int spins = 0;
+    for (;;) {
+        long epoch = atomic_load(&pool.epoch);
+        pool_task_t *t = find_task(w);
+        if (t) {
+            run_task(w, t);
+            spins = 0;
+            continue;
+        }
+        if (atomic_load(&pool.stop))
+            break;
+        if (++spins < POOL_SPINS) {
+            sched_yield();
+            continue;
+        }
+
+        /* Sleep unless tasks were pushed since looking for them */
+        spins = 0;
+        pthread_mutex_lock(&pool.lock);
+        if (atomic_load(&pool.epoch) == epoch && !atomic_load(&pool.stop)) {
+            pool.sleepers++;
+            count(&w->idle);
+            pthread_cond_wait(&pool.wake, &pool.lock);
+            pool.sleepers--;
+        }
+        pthread_mutex_unlock(&pool.lock);
+    }
+    return NULL;
+}
+
+/* Wake up to @n sleeping workers for the tasks just pushed */
+static void wake_workers(int n)
+{
+    pthread_mutex_lock(&pool.lock);
+    atomic_fetch_add(&pool.epoch, 1);
+    if (n >= pool.sleepers)
+        pthread_cond_broadcast(&pool.wake);
+    else
+        while (n--)
+            pthread_cond_signal(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/* Start @threads - 1 workers, with signals blocked by the caller. Workers
+ * whose thread cannot be started keep an empty deque.
+ */
+static void pool_start(int threads)
+{
+    pool.workers = calloc(threads, sizeof(worker_t));
+    if (!pool.workers)
+        return;
+    pool.threads = threads;
+    for (int i = 0; i < threads; i++)
+        pool.workers[i].index = i;
+    for (pool.started = 1; pool.started < threads; pool.started++) {
+        worker_t *w = &pool.workers[pool.started];
+        if (pthread_create(&w->tid, NULL, worker_main, w))
+            break;
+    }
+}
+
+void pool_stop(void)
+{
+    if (!pool.workers)
+        return;
+
+    pthread_mutex_lock(&pool.lock);
+    atomic_store(&pool.stop, true);
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+    for (int i = 1; i < pool.started; i++)
+        pthread_join(pool.workers[i].tid, NULL);
+
+    free(pool.workers);
+    pool.workers = NULL;
+    pool.threads = pool.started = 0;
+    atomic_store(&pool.stop, false);
+}
+
+/* Become the first worker of a pool of pool_threads threads, starting or
+ * restarting it as needed. Return false if there is no pool to use.
+ */
+static bool pool_enter(void)
+{
+    int threads = pool_threads < POOL_MAX_THREADS ? pool_threads
+                                                   : POOL_MAX_THREADS;
+    bool busy = false;
+    if (threads < 2 ||
+        !atomic_compare_exchange_strong(&pool.caller_busy, &busy, true))
+        return false;
+
+    if (pool.threads != threads) {
+        pool_stop();
+        pool_start(threads);
+    }
+    if (pool.started < 2) {
+        atomic_store(&pool.caller_busy, false);
+        return false;
+    }
+    self = &pool.workers[0];
+    return true;
+}
+
+void pool_run(pool_task_t *tasks, int n)
+{
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    bool outer = !self;
+    if (n < 2 || (outer && !pool_enter())) {
+        for (int i = 0; i < n; i++)
+            tasks[i].func(tasks[i].arg);
+    } else {
+        atomic_int pending;
+        atomic_init(&pending, n);
+
+        /* Push the last tasks first, so that thieves take them and this
+         * thread goes on with the first ones
+         */
+        int pushed = 0;
+        for (int i = n - 1; i > 0; i--) {
+            tasks[i].pending = &pending;
+            if (deque_push(&self->deque, &tasks[i]))
+                pushed++;
+            else
+                run_task(self, &tasks[i]);
+        }
+        if (pushed)
+            wake_workers(pushed);
+
+        tasks[0].pending = &pending;
+        run_task(self, &tasks[0]);
+        while (atomic_load_explicit(&pending, memory_order_acquire)) {
+            pool_task_t *t = find_task(self);
+            if (t)
+                run_task(self, t);
+            else
+                sched_yield();
+        }
+    }
+
+    if (outer && self) {
+        self = NULL;
+        atomic_store(&pool.caller_busy, false);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+int pool_stats(pool_stats_t *stats, int max)
+{
+    int n = pool.threads < max ? pool.threads : max;
+    for (int i = 0; i < n; i++) {
+        worker_t *w = &pool.workers[i];
+        stats[i] = (pool_stats_t){
+            .tasks = atomic_load_explicit(&w->tasks, memory_order_relaxed),
+            .steals = atomic_load_explicit(&w->steals, memory_order_relaxed),
+            .idle = atomic_load_explicit(&w->idle, memory_order_relaxed),
+        };
+    }
+    return n;
+}
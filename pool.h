@@ -0,0 +1,87 @@
+#ifndef LAB0_POOL_H
+#define LAB0_POOL_H
+
+/* Work-stealing thread pool shared by the parallel queue operations.
+ *
+ * Work is handed over as fork-join rounds: pool_run() runs a set of tasks
+ * and returns once all of them are done. Each thread of the pool, the one
+ * calling pool_run() included, owns a Chase-Lev deque. A round pushes its
+ * tasks onto the deque of the calling thread and works on them from the
+ * bottom, while idle workers steal from the top of any deque. Waiting for a
+ * round to finish, a thread keeps running tasks, so rounds may nest.
+ *
+ * Workers block signals, and so does pool_run() until the round is over,
+ * since the alarm of the harness jumps back to the command loop, which must
+ * not leave tasks running on the queue.
+ *
+ * The pool allocates outside of the harness. Its threads are started by the
+ * first round and kept until pool_stop(), or until the number of threads is
+ * changed.
+ *
+ * Sorting and q_merge() run their parts on the pool. Freeing does not: the
+ * harness hands a block freed by another thread back to the one holding its
+ * list, so workers would only queue the frees up for the caller. Taking
+ * frees off the command is left to the reclaimer of reclaim.h, which borrows
+ * the lists of the console thread with test_lend() and so unlinks and frees
+ * the blocks itself. Nor does the entropy q_show() prints run on the pool, as
+ * it is computed for a few dozen strings at most.
+ */
+
+#include <stdatomic.h>
+
+/* Upper bound on the threads of the pool, the calling one included */
+#define POOL_MAX_THREADS 64
+
+/* Threads parallel operations use, the calling one included. Settable with
+ * "option threads" in qtest.
+ */
+extern int pool_threads;
+
+/**
+ * pool_task_t - Task of a round
+ * @func: function to run
+ * @arg: argument passed to @func
+ * @pending: set by pool_run(), counts the tasks of the round left to finish
+ */
+typedef struct {
+    void (*func)(void *arg);
+    void *arg;
+    atomic_int *pending;
+} pool_task_t;
+
+/**
+ * pool_run() - Run tasks concurrently and wait for all of them
+ * @tasks: the tasks, the first of which the calling thread starts with
+ * @n: number of tasks
+ *
+ * Tasks may call pool_run() themselves. With a single thread, or when
+ * another thread outside of the pool is running a round already, the tasks
+ * run one after the other on the calling thread.
+ */
+void pool_run(pool_task_t *tasks, int n);
+
+/**
+ * pool_stats_t - Counters of one thread of the pool
+ * @tasks: tasks it ran
+ * @steals: tasks it took from the deque of another thread
+ * @idle: times it went to sleep for lack of work
+ */
+typedef struct {
+    long tasks;
+    long steals;
+    long idle;
+} pool_stats_t;
+
+/**
+ * pool_stats() - Read the counters of the threads of the pool
+ * @stats: array receiving them, the thread calling pool_run() first
+ * @max: room in @stats
+ *
+ * Return: the number of threads, which is zero if the pool is not started
+ */
+int pool_stats(pool_stats_t *stats, int max);
+
+/* Stop the threads of the pool. The next round starts them again */
+void pool_stop(void);
+
+#endif /* LAB0_POOL_H */
@@ -3,12 +3,16 @@
 #include <assert.h>
 #include <errno.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <spawn.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h> /* strcasecmp */
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -20,6 +24,7 @@
 #endif
 
 #include "dudect/fixture.h"
+#include "extsort.h"
 #include "list.h"
 #include "random.h"
 
@@ -44,8 +49,17 @@ extern int show_entropy;
  */
 #include "queue.h"
 
+#include "bqueue.h"
 #include "console.h"
+#include "mapq.h"
+#include "mpmc.h"
+#include "pool.h"
+#include "reclaim.h"
 #include "report.h"
+#include "ring.h"
+#include "snapshot.h"
+#include "sort.h"
+#include "spsc.h"
 
 /* Settable parameters */
 
@@ -57,6 +71,22 @@ extern int show_entropy;
  */
 #define BIG_LIST_SIZE 30
 
+/* Can equal strings inserted into the queue share one copy? */
+#ifdef QUEUE_INTERN
+#define SHARED_STRINGS true
+#else
+#define SHARED_STRINGS false
+#endif
+
+/* Can threads create and release elements at once? Chunks of the unrolled
+ * backend and interned strings are shared without locking.
+ */
+#if defined(QUEUE_BACKEND_UNROLLED) || defined(QUEUE_INTERN)
+#define THREADED_ELEMENTS false
+#else
+#define THREADED_ELEMENTS true
+#endif
+
 /* Global variables */
 
 typedef struct {
@@ -126,6 +156,9 @@ static bool do_free(int argc, char *argv[])
 
     q_show(3);
 
+    /* With no queue left, the reclaimer must be done for the count to hold */
+    if (!chain.size)
+        reclaim_sync();
     size_t bcnt = allocation_check();
     if (!chain.size && bcnt > 0) {
         report(1,
@@ -137,25 +170,53 @@ static bool do_free(int argc, char *argv[])
     return ok && !error_check();
 }
 
-static bool do_new(int argc, char *argv[])
+/* Wait for the reclaimer, then check for leaks as do_free() does */
+static bool do_sync(int argc, char *argv[])
 {
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
     }
 
-    bool ok = true;
+    double start;
+    init_time(&start);
+    reclaim_sync();
+    report(2, "Waited %.3f s for the reclaimer", delta_time(&start));
 
-    if (exception_setup(true)) {
-        queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
-        list_add_tail(&qctx->chain, &chain.head);
+    size_t bcnt = allocation_check();
+    if (!chain.size && bcnt > 0) {
+        report(1,
+               "ERROR: There is no queue, but %lu blocks are still allocated",
+               bcnt);
+        return false;
+    }
+    return !error_check();
+}
+
+/* Append a new empty queue to the chain and make it the current one */
+static void add_queue(void)
+{
+    queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
+    list_add_tail(&qctx->chain, &chain.head);
 
-        qctx->size = 0;
-        qctx->q = q_new();
-        qctx->id = chain.size++;
+    qctx->size = 0;
+    qctx->q = q_new();
+    qctx->id = chain.size++;
 
-        current = qctx;
+    current = qctx;
+}
+
+static bool do_new(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
     }
+
+    bool ok = true;
+
+    if (exception_setup(true))
+        add_queue();
     exception_cancel();
     q_show(3);
 
@@ -178,6 +239,34 @@ static void fill_rand_string(char *buf, size_t buf_size)
 }
 
 /* insertion */
+/* Insert @n copies of @s in one call where possible, counting failures the
+ * same way as one insertion at a time
+ */
+static bool queue_insert_n(position_t pos, char *s, int n)
+{
+    bool ok = true;
+    while (ok && n > 0) {
+        int count = pos == POS_TAIL ? q_insert_tail_n(current->q, s, n)
+                                    : q_insert_head_n(current->q, s, n);
+        current->size += count;
+        n -= count;
+        if (n > 0) {
+            /* Skip the insertion that failed and retry the rest */
+            n--;
+            fail_count++;
+            if (fail_count < fail_limit)
+                report(2, "Insertion of %s failed", s);
+            else {
+                report(1, "ERROR: Insertion of %s failed (%d failures total)",
+                       s, fail_count);
+                ok = false;
+            }
+        }
+        ok = ok && !error_check();
+    }
+    return ok;
+}
+
 static bool queue_insert(position_t pos, int argc, char *argv[])
 {
     if (simulation) {
@@ -224,17 +313,23 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
     error_check();
 
     if (current && exception_setup(true)) {
-        for (int r = 0; ok && r < reps; r++) {
+        int r = 0;
+        for (; ok && r < reps; r++) {
+            /* Once the first two insertions have shown that every element
+             * gets its own copy, insert the remaining ones in a batch.
+             */
+            if (r == 2 && !need_rand)
+                break;
             if (need_rand)
                 fill_rand_string(randstr_buf, sizeof(randstr_buf));
             bool rval = pos == POS_TAIL ? q_insert_tail(current->q, inserts)
                                         : q_insert_head(current->q, inserts);
             if (rval) {
                 current->size++;
-                element_t *entry =
-                    pos == POS_TAIL
-                        ? list_last_entry(current->q, element_t, list)
-                        : list_first_entry(current->q, element_t, list);
+                element_t *entry = list_entry(
+                    pos == POS_TAIL ? q_prev(current->q, current->q)
+                                    : q_next(current->q, current->q),
+                    element_t, list);
                 char *cur_inserts = entry->value;
                 if (!cur_inserts) {
                     report(1, "ERROR: Failed to save copy of string in queue");
@@ -245,7 +340,7 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
                            "queue element");
                     ok = false;
                     break;
-                } else if (r == 1 && lasts == cur_inserts) {
+                } else if (r == 1 && !SHARED_STRINGS && lasts == cur_inserts) {
                     report(1,
                            "ERROR: Need to allocate separate string for each "
                            "queue element");
@@ -266,6 +361,8 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
             }
             ok = ok && !error_check();
         }
+        if (ok && r < reps)
+            ok = queue_insert_n(pos, inserts, reps - r);
     }
     exception_cancel();
 
@@ -431,23 +528,29 @@ static bool do_dedup(int argc, char *argv[])
 
     // Copy current->q to l_copy
     if (current->q && !list_empty(current->q)) {
-        list_for_each_entry (item, current->q, list) {
+        struct list_head *cur;
+        for (cur = q_next(current->q, current->q); cur != current->q;
+             cur = q_next(current->q, cur)) {
+            item = list_entry(cur, element_t, list);
             size_t slen;
             tmp = malloc(sizeof(element_t));
             if (!tmp)
                 break;
             INIT_LIST_HEAD(&tmp->list);
-            slen = strlen(item->value) + 1;
-            tmp->value = malloc(slen);
+            slen = element_len(item);
+            tmp->value = malloc(slen + 1);
             if (!tmp->value) {
                 free(tmp);
                 break;
             }
             memcpy(tmp->value, item->value, slen);
+            tmp->value[slen] = '\0';
+            tmp->key = item->key;
+            tmp->mapped = false;
             list_add_tail(&tmp->list, &l_copy);
         }
         // Return false if the loop does not leave properly
-        if (&item->list != current->q) {
+        if (cur != current->q) {
             list_for_each_entry_safe (item, tmp, &l_copy, list) {
                 free(item->value);
                 free(item);
@@ -473,22 +576,21 @@ static bool do_dedup(int argc, char *argv[])
         return false;
     }
 
-    struct list_head *l_tmp = current->q->next;
+    struct list_head *l_tmp = q_next(current->q, current->q);
     bool is_this_dup = false;
     // Compare between new list and old one
     list_for_each_entry (item, &l_copy, list) {
         // Skip comparison with new list if the string is duplicate
         bool is_next_dup =
             item->list.next != &l_copy &&
-            strcmp(list_entry(item->list.next, element_t, list)->value,
-                   item->value) == 0;
+            element_cmp(list_entry(item->list.next, element_t, list),
+                        item) == 0;
         if (is_this_dup || is_next_dup) {
             // Update list size
             current->size--;
         } else if (l_tmp != current->q &&
-                   strcmp(list_entry(l_tmp, element_t, list)->value,
-                          item->value) == 0)
-            l_tmp = l_tmp->next;
+                   !element_cmp(list_entry(l_tmp, element_t, list), item))
+            l_tmp = q_next(current->q, l_tmp);
         else
             ok = false;
         is_this_dup = is_next_dup;
@@ -509,6 +611,66 @@ static bool do_dedup(int argc, char *argv[])
     return ok && !error_check();
 }
 
+static bool do_rhn(int argc, char *argv[])
+{
+    int k = 0;
+    if (argc != 1 && argc != 2) {
+        report(1, "%s needs 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    if (argc == 2 && !get_int(argv[1], &k)) {
+        report(1, "Invalid number of removals '%s'", argv[1]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling remove head on null queue");
+        return false;
+    }
+    error_check();
+
+    LIST_HEAD(removed);
+    int cnt = 0;
+    set_noallocate_mode(true);
+    if (exception_setup(true)) {
+        if (argc == 1)
+            q_drain(current->q, &removed);
+        else
+            cnt = q_remove_head_n(current->q, k, &removed);
+    }
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    int expected = current->size;
+    if (argc == 2 && k < expected)
+        expected = k < 0 ? 0 : k;
+
+    int n = 0;
+    struct list_head *node;
+    list_for_each (node, &removed)
+        n++;
+
+    bool ok = true;
+    if (n != expected || (argc == 2 && cnt != n)) {
+        report(1, "ERROR: Removed %d elements, but expected %d", n, expected);
+        ok = false;
+    } else {
+        report(2, "Removed %d elements from queue", n);
+    }
+    current->size -= n;
+
+    if (n > BIG_LIST_SIZE)
+        set_cautious_mode(false);
+    element_t *item, *tmp;
+    list_for_each_entry_safe (item, tmp, &removed, list)
+        q_release_element(item);
+    set_cautious_mode(true);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
 static bool do_reverse(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -604,14 +766,14 @@ bool do_sort(int argc, char *argv[])
 
     bool ok = true;
     if (current && current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
+        for (struct list_head *cur_l = q_next(current->q, current->q);
+             cur_l != current->q && --cnt; cur_l = q_next(current->q, cur_l)) {
             /* Ensure each element in ascending order */
             /* FIXME: add an option to specify sorting order */
             element_t *item, *next_item;
             item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) > 0) {
+            next_item = list_entry(q_next(current->q, cur_l), element_t, list);
+            if (element_cmp(item, next_item) > 0) {
                 report(1, "ERROR: Not sorted in ascending order");
                 ok = false;
                 break;
@@ -623,6 +785,1037 @@ bool do_sort(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Sort random strings with the external sort, without any queue, so that
+ * the count is not bounded by the memory the queue would take
+ */
+static bool do_xsort(int argc, char *argv[])
+{
+    int n;
+    if (argc != 2 || !get_int(argv[1], &n) || n < 0) {
+        report(1, "%s needs a number of strings", argv[0]);
+        return false;
+    }
+
+    extsort_t *ext = extsort_new((size_t) sort_memory << 10);
+    if (!ext) {
+        report(1, "ERROR: Could not start the external sort");
+        return false;
+    }
+
+    char buf[MAX_RANDSTR_LEN];
+    bool ok = true;
+    for (int i = 0; ok && i < n; i++) {
+        fill_rand_string(buf, sizeof(buf));
+        ok = extsort_add(ext, buf, strlen(buf), i);
+    }
+    ok = ok && extsort_finish(ext);
+    if (!ok)
+        report(1, "ERROR: External sort failed");
+
+    /* Check the order, and that equal strings kept theirs */
+    char prev[MAX_RANDSTR_LEN];
+    size_t prev_len = 0;
+    uint64_t prev_tag = 0;
+    const char *s;
+    size_t len;
+    uint64_t tag;
+    int cnt = 0;
+    while (ok && extsort_next(ext, &s, &len, &tag)) {
+        int cmp = memcmp(prev, s, prev_len < len ? prev_len : len);
+        if (!cmp)
+            cmp = prev_len < len ? -1 : prev_len > len;
+        if (cnt && (cmp > 0 || (!cmp && prev_tag > tag))) {
+            report(1, "ERROR: Not sorted in ascending order");
+            ok = false;
+        }
+        memcpy(prev, s, len);
+        prev_len = len;
+        prev_tag = tag;
+        cnt++;
+    }
+    if (ok && cnt != n) {
+        report(1, "ERROR: Sorted %d strings, but expected %d", cnt, n);
+        ok = false;
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    report(2, "Sorted %d strings in %zu runs, peak RSS %ld KiB", cnt,
+           extsort_runs(ext), usage.ru_maxrss);
+    extsort_free(ext);
+    return ok && !error_check();
+}
+
+/* Rate in millions per second of @count items done in @elapsed seconds, as
+ * the benchmark commands report it
+ */
+static double mega_rate(double count, double elapsed)
+{
+    return elapsed > 0 ? count / elapsed / 1e6 : 0.0;
+}
+
+/* Upper bound on the producers, and on the consumers, of the mpmc command */
+#define MPMC_MAX_THREADS 64
+
+/* Cells of the queue the mpmc command passes elements through */
+#define MPMC_CAPACITY 1024
+
+/**
+ * mpmc_bench_t - One round of the mpmc command
+ * @q: queue the elements go through
+ * @msg: elements, the key of each being its index
+ * @seen: whether each element was removed already
+ * @n: number of elements
+ * @threads: number of producers, and of consumers
+ * @removed: elements removed so far
+ * @errors: elements removed twice or out of the order of their producer
+ * @abort: a thread could not be started, everyone stops
+ */
+typedef struct {
+    mpmc_t *q;
+    element_t *msg;
+    atomic_uchar *seen;
+    int n;
+    int threads;
+    atomic_int removed;
+    atomic_int errors;
+    atomic_bool abort;
+} mpmc_bench_t;
+
+typedef struct {
+    mpmc_bench_t *bench;
+    int id;
+} mpmc_worker_t;
+
+/* Producer @id inserts the elements whose index is @id modulo the number of
+ * producers, in ascending order
+ */
+static void *mpmc_produce(void *arg)
+{
+    mpmc_worker_t *w = arg;
+    mpmc_bench_t *b = w->bench;
+    for (int i = w->id; i < b->n; i += b->threads) {
+        while (!mpmc_insert_tail(b->q, &b->msg[i])) {
+            if (atomic_load_explicit(&b->abort, memory_order_relaxed))
+                return NULL;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/* A consumer must see the elements of each producer in ascending order */
+static void *mpmc_consume(void *arg)
+{
+    mpmc_worker_t *w = arg;
+    mpmc_bench_t *b = w->bench;
+    int64_t last[MPMC_MAX_THREADS];
+    for (int i = 0; i < b->threads; i++)
+        last[i] = -1;
+
+    while (atomic_load_explicit(&b->removed, memory_order_relaxed) < b->n) {
+        element_t *e = mpmc_remove_head(b->q);
+        if (!e) {
+            if (atomic_load_explicit(&b->abort, memory_order_relaxed))
+                return NULL;
+            sched_yield();
+            continue;
+        }
+        atomic_fetch_add_explicit(&b->removed, 1, memory_order_relaxed);
+
+        int64_t i = e->key;
+        int producer = i % b->threads;
+        if (atomic_exchange_explicit(&b->seen[i], 1, memory_order_relaxed) ||
+            i <= last[producer])
+            atomic_fetch_add_explicit(&b->errors, 1, memory_order_relaxed);
+        last[producer] = i;
+    }
+    return NULL;
+}
+
+/* Pass the elements of @b through its queue with @b->threads producers and
+ * as many consumers. Return false if a thread could not be started.
+ */
+static bool mpmc_round(mpmc_bench_t *b)
+{
+    pthread_t tid[2 * MPMC_MAX_THREADS];
+    mpmc_worker_t worker[2 * MPMC_MAX_THREADS];
+    int started = 0;
+
+    for (int i = 0; i < 2 * b->threads; i++) {
+        worker[i] = (mpmc_worker_t){.bench = b, .id = i % b->threads};
+        if (pthread_create(&tid[i], NULL,
+                           i < b->threads ? mpmc_produce : mpmc_consume,
+                           &worker[i])) {
+            atomic_store(&b->abort, true);
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++)
+        pthread_join(tid[i], NULL);
+    return started == 2 * b->threads;
+}
+
+/* Measure the throughput of the lock-free queue with 1, 2, 4... producers and
+ * as many consumers, checking that every element comes out once and in order
+ */
+static bool do_mpmc(int argc, char *argv[])
+{
+    int n, max_threads = 32;
+    if (argc < 2 || argc > 3 || !get_int(argv[1], &n) || n <= 0 ||
+        (argc == 3 && (!get_int(argv[2], &max_threads) || max_threads < 1 ||
+                       max_threads > MPMC_MAX_THREADS))) {
+        report(1, "%s needs a number of elements and at most %d threads",
+               argv[0], MPMC_MAX_THREADS);
+        return false;
+    }
+
+    mpmc_bench_t b = {.n = n};
+    b.q = mpmc_new(MPMC_CAPACITY);
+    b.msg = malloc(n * sizeof(element_t));
+    b.seen = malloc(n * sizeof(atomic_uchar));
+    bool ok = b.q && b.msg && b.seen;
+    if (!ok)
+        report(1, "ERROR: Could not allocate %d elements", n);
+    for (int i = 0; ok && i < n; i++)
+        b.msg[i] = (element_t){.value = NULL, .key = i};
+
+    for (int threads = 1; ok && threads <= max_threads; threads *= 2) {
+        b.threads = threads;
+        atomic_init(&b.removed, 0);
+        atomic_init(&b.errors, 0);
+        atomic_init(&b.abort, false);
+        for (int i = 0; i < n; i++)
+            atomic_init(&b.seen[i], 0);
+
+        double start;
+        init_time(&start);
+        if (!mpmc_round(&b)) {
+            report(1, "ERROR: Could not start %d threads", 2 * threads);
+            ok = false;
+            break;
+        }
+        double elapsed = delta_time(&start);
+
+        int errors = atomic_load(&b.errors);
+        if (errors) {
+            report(1, "ERROR: %d elements removed twice or out of order",
+                   errors);
+            ok = false;
+        }
+        report(2, "%2d producers, %2d consumers: %.2f M elements/s", threads,
+               threads, mega_rate(n, elapsed));
+    }
+
+    free(b.seen);
+    free(b.msg);
+    mpmc_free(b.q);
+    return ok && !error_check();
+}
+
+/* Cells of the queue the pipe command passes elements through */
+#define PIPE_CAPACITY 1024
+
+/* Upper bound on the batch size of the pipe command */
+#define PIPE_MAX_BATCH 256
+
+/**
+ * pipe_bench_t - Run of the pipe command
+ * @q: queue between the producer and the consumer
+ * @msg: elements the producer cycles through. Their key is the time they
+ *       were inserted at, in nanoseconds
+ * @pool: number of elements in @msg, enough that none is reused before the
+ *        consumer is done with it
+ * @latency: time each element spent in the queue, in nanoseconds
+ * @n: number of elements to pass
+ * @batch: elements moved per call on either side
+ * @errors: elements received out of order
+ */
+typedef struct {
+    spsc_t *q;
+    element_t *msg;
+    int pool;
+    uint32_t *latency;
+    int n;
+    int batch;
+    int errors;
+} pipe_bench_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *pipe_produce(void *arg)
+{
+    pipe_bench_t *b = arg;
+    element_t *batch[PIPE_MAX_BATCH];
+    for (int i = 0; i < b->n;) {
+        int k = b->n - i < b->batch ? b->n - i : b->batch;
+        uint64_t now = now_ns();
+        for (int j = 0; j < k; j++) {
+            batch[j] = &b->msg[(i + j) % b->pool];
+            batch[j]->key = now;
+        }
+        for (int done = 0; done < k;) {
+            size_t cnt = spsc_insert_tail(b->q, batch + done, k - done);
+            if (!cnt)
+                sched_yield();
+            done += cnt;
+        }
+        i += k;
+    }
+    return NULL;
+}
+
+static void *pipe_consume(void *arg)
+{
+    pipe_bench_t *b = arg;
+    element_t *batch[PIPE_MAX_BATCH];
+    for (int i = 0; i < b->n;) {
+        size_t k = spsc_remove_head(b->q, batch, b->batch);
+        if (!k) {
+            sched_yield();
+            continue;
+        }
+        uint64_t now = now_ns();
+        for (size_t j = 0; j < k; j++, i++) {
+            if (batch[j] != &b->msg[i % b->pool])
+                b->errors++;
+            uint64_t t = now - batch[j]->key;
+            b->latency[i] = t > UINT32_MAX ? UINT32_MAX : t;
+        }
+    }
+    return NULL;
+}
+
+static int cmp_latency(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* Pass elements from a producer thread to a consumer thread through the
+ * wait-free queue, and report the throughput and the time elements waited
+ */
+static bool do_pipe(int argc, char *argv[])
+{
+    int n, batch = 32;
+    if (argc < 2 || argc > 3 || !get_int(argv[1], &n) || n <= 0 ||
+        (argc == 3 && (!get_int(argv[2], &batch) || batch < 1 ||
+                       batch > PIPE_MAX_BATCH))) {
+        report(1, "%s needs a number of elements and a batch size up to %d",
+               argv[0], PIPE_MAX_BATCH);
+        return false;
+    }
+
+    pipe_bench_t b = {.n = n, .batch = batch};
+    b.pool = PIPE_CAPACITY + 2 * PIPE_MAX_BATCH;
+    b.q = spsc_new(PIPE_CAPACITY);
+    b.msg = calloc(b.pool, sizeof(element_t));
+    b.latency = malloc(n * sizeof(uint32_t));
+    bool ok = b.q && b.msg && b.latency;
+    if (!ok)
+        report(1, "ERROR: Could not allocate %d elements", n);
+
+    pthread_t producer, consumer;
+    double start, elapsed = 0;
+    init_time(&start);
+    if (ok && pthread_create(&consumer, NULL, pipe_consume, &b)) {
+        report(1, "ERROR: Could not start the consumer");
+        ok = false;
+    }
+    if (ok) {
+        /* Without a producer, play its part so the consumer can finish */
+        if (pthread_create(&producer, NULL, pipe_produce, &b)) {
+            report(1, "ERROR: Could not start the producer");
+            pipe_produce(&b);
+            ok = false;
+        } else {
+            pthread_join(producer, NULL);
+        }
+        pthread_join(consumer, NULL);
+        elapsed = delta_time(&start);
+    }
+
+    if (ok && b.errors) {
+        report(1, "ERROR: %d elements received out of order", b.errors);
+        ok = false;
+    }
+    if (ok) {
+        qsort(b.latency, n, sizeof(uint32_t), cmp_latency);
+        report(2, "%d elements in %.3f s: %.2f M elements/s", n, elapsed,
+               mega_rate(n, elapsed));
+        report(2,
+               "Latency (ns): p50 %u, p90 %u, p99 %u, p99.9 %u, max %u",
+               b.latency[n / 2], b.latency[(int) (n * 0.9)],
+               b.latency[(int) (n * 0.99)], b.latency[(int) (n * 0.999)],
+               b.latency[n - 1]);
+    }
+
+    free(b.latency);
+    free(b.msg);
+    spsc_free(b.q);
+    return ok && !error_check();
+}
+
+/* Elements the ring command removes from the middle */
+#define RING_MID_REMOVALS 1000
+
+/* Whether the first @n elements of @r are those of queue @head, in order */
+static bool ring_matches(const ring_t *r, struct list_head *head, size_t n)
+{
+    struct list_head *node = q_next(head, head);
+    for (size_t i = 0; i < n; i++, node = q_next(head, node)) {
+        if (node == head || ring_at(r, i) != list_entry(node, element_t, list))
+            return false;
+    }
+    return true;
+}
+
+/* Put n random strings of a queue through the ring deque: fill it, cycle it
+ * through, reverse it, sort it and empty it from the middle. Each step is
+ * checked against the queue, and timed.
+ */
+static bool do_ring(int argc, char *argv[])
+{
+    int n;
+    if (argc != 2 || !get_int(argv[1], &n) || n <= 0) {
+        report(1, "%s needs a number of strings", argv[0]);
+        return false;
+    }
+
+    struct list_head *q = q_new();
+    ring_t *r = ring_new(0);
+    bool ok = q && r;
+    char buf[MAX_RANDSTR_LEN];
+    for (int i = 0; ok && i < n; i++) {
+        fill_rand_string(buf, sizeof(buf));
+        ok = q_insert_tail(q, buf);
+    }
+    if (!ok) {
+        report(1, "ERROR: Could not allocate %d strings", n);
+        ring_free(r);
+        q_free(q);
+        return false;
+    }
+
+    double start, elapsed;
+    struct list_head *node;
+    init_time(&start);
+    for (node = q_next(q, q); ok && node != q; node = q_next(q, node))
+        ok = ring_push_tail(r, list_entry(node, element_t, list));
+    elapsed = delta_time(&start);
+    if (!ok || !ring_matches(r, q, n)) {
+        report(1, "ERROR: Ring does not hold the queue");
+        ok = false;
+    } else {
+        report(2, "push tail:    %.2f M elements/s", mega_rate(n, elapsed));
+    }
+
+    /* Moving every element from head to tail brings the order back */
+    if (ok) {
+        init_time(&start);
+        for (int i = 0; ok && i < n; i++)
+            ok = ring_push_tail(r, ring_pop_head(r));
+        elapsed = delta_time(&start);
+        if (!ok || !ring_matches(r, q, n)) {
+            report(1, "ERROR: Ring out of order after a round of moves");
+            ok = false;
+        } else {
+            report(2, "head to tail: %.2f M elements/s",
+                   mega_rate(n, elapsed));
+        }
+    }
+
+    if (ok) {
+        ring_reverse(r);
+        q_reverse(q);
+        ok = ring_matches(r, q, n);
+        ring_reverse(r);
+        q_reverse(q);
+        if (!ok || !ring_matches(r, q, n)) {
+            report(1, "ERROR: Ring out of order after reversing");
+            ok = false;
+        }
+    }
+
+    /* Both sorts are stable on element_cmp(), so equal strings agree too */
+    if (ok) {
+        init_time(&start);
+        ok = ring_sort(r);
+        elapsed = delta_time(&start);
+        q_sort(q);
+        if (!ok || !ring_matches(r, q, n)) {
+            report(1, "ERROR: Ring and queue sorted differently");
+            ok = false;
+        } else {
+            report(2, "sort:         %.3f s", elapsed);
+        }
+    }
+
+    /* Each removal from the middle moves half of the pointers, so only the
+     * first few are, and the ends take the rest
+     */
+    if (ok) {
+        int mids = n < RING_MID_REMOVALS ? n : RING_MID_REMOVALS;
+        init_time(&start);
+        for (size_t size = n; ok && size > (size_t) (n - mids); size--) {
+            size_t mid = size / 2;
+            element_t *e = ring_at(r, mid);
+            ok = ring_remove_at(r, mid) == e &&
+                 (!mid || mid + 1 >= size ||
+                  element_cmp(ring_at(r, mid - 1), ring_at(r, mid)) <= 0);
+        }
+        elapsed = delta_time(&start);
+        element_t *prev = NULL, *e;
+        while (ok && (e = ring_pop_head(r))) {
+            ok = !prev || element_cmp(prev, e) <= 0;
+            prev = e;
+        }
+        if (!ok || ring_size(r)) {
+            report(1, "ERROR: Removing from the middle broke the order");
+            ok = false;
+        } else {
+            report(2, "delete mid:   %.2f M elements/s",
+                   mega_rate(mids, elapsed));
+        }
+    }
+
+    /* Looking every freed block up among thousands would dominate the run */
+    set_cautious_mode(false);
+    ring_free(r);
+    q_free(q);
+    set_cautious_mode(true);
+    return ok && !error_check();
+}
+
+/* Upper bound on the producers, and on the consumers, of the bq command */
+#define BQ_MAX_THREADS 64
+
+/* Elements above which the producers of the bq command wait */
+#define BQ_CAPACITY 1024
+
+/* Elements moved at once by either side of the bq command */
+#define BQ_BATCH 64
+
+/**
+ * bq_bench_t - Run of the bq command
+ * @bq: queue between the producers and the consumers
+ * @seen: whether each string was received already
+ * @n: number of strings, the decimal numbers from 0 to @n - 1
+ * @producers: number of producers, each sending the numbers equal to its
+ *             index modulo @producers
+ * @sent: elements sent
+ * @received: elements received
+ * @failed: elements which could not be allocated
+ * @errors: strings received twice or out of the order of their producer
+ */
+typedef struct {
+    bqueue_t *bq;
+    atomic_uchar *seen;
+    int n;
+    int producers;
+    atomic_int sent;
+    atomic_int received;
+    atomic_int failed;
+    atomic_int errors;
+} bq_bench_t;
+
+typedef struct {
+    bq_bench_t *bench;
+    int id;
+} bq_worker_t;
+
+/* Build batches of elements in a queue of the producer's own, and move each
+ * to the shared queue at once
+ */
+static void *bq_produce(void *arg)
+{
+    bq_worker_t *w = arg;
+    bq_bench_t *b = w->bench;
+    int total = (b->n - w->id + b->producers - 1) / b->producers;
+    struct list_head *q = q_new();
+    if (!q) {
+        atomic_fetch_add(&b->failed, total);
+        return NULL;
+    }
+
+    char buf[16];
+    for (int i = w->id; i < b->n;) {
+        int k = 0;
+        for (; k < BQ_BATCH && i < b->n; i += b->producers) {
+            snprintf(buf, sizeof(buf), "%d", i);
+            if (q_insert_tail(q, buf))
+                k++;
+            else
+                atomic_fetch_add(&b->failed, 1);
+        }
+
+        LIST_HEAD(batch);
+        q_drain(q, &batch);
+        if (!q_push_blocking(b->bq, &batch, k, -1)) {
+            /* Closed under our feet: the elements are ours to release */
+            element_t *e, *safe;
+            list_for_each_entry_safe (e, safe, &batch, list)
+                q_release_element(e);
+            atomic_fetch_add(&b->errors, k);
+            break;
+        }
+        atomic_fetch_add(&b->sent, k);
+    }
+    q_free(q);
+    return NULL;
+}
+
+/* Release every element received, checking that the strings of each producer
+ * come in ascending order
+ */
+static void *bq_consume(void *arg)
+{
+    bq_worker_t *w = arg;
+    bq_bench_t *b = w->bench;
+    int last[BQ_MAX_THREADS];
+    for (int i = 0; i < b->producers; i++)
+        last[i] = -1;
+
+    LIST_HEAD(batch);
+    int k;
+    while ((k = q_pop_blocking(b->bq, &batch, BQ_BATCH, -1))) {
+        element_t *e, *safe;
+        list_for_each_entry_safe (e, safe, &batch, list) {
+            int i = atoi(e->value);
+            int producer = i % b->producers;
+            if (i < 0 || i >= b->n || i <= last[producer] ||
+                atomic_exchange(&b->seen[i], 1))
+                atomic_fetch_add(&b->errors, 1);
+            else
+                last[producer] = i;
+            q_release_element(e);
+        }
+        INIT_LIST_HEAD(&batch);
+        atomic_fetch_add(&b->received, k);
+    }
+    return NULL;
+}
+
+/* Pass strings from producer threads to consumer threads through the blocking
+ * queue. Threads create and release the elements through the harness, so no
+ * block may be left once they are done.
+ */
+static bool do_bq(int argc, char *argv[])
+{
+    int n, producers = 4, consumers = 4;
+    if (argc < 2 || argc > 4 || !get_int(argv[1], &n) || n <= 0 ||
+        (argc > 2 && (!get_int(argv[2], &producers) || producers < 1 ||
+                      producers > BQ_MAX_THREADS)) ||
+        (argc > 3 && (!get_int(argv[3], &consumers) || consumers < 1 ||
+                      consumers > BQ_MAX_THREADS))) {
+        report(1, "%s needs a number of strings, then up to %d producers and "
+               "consumers", argv[0], BQ_MAX_THREADS);
+        return false;
+    }
+    if (!THREADED_ELEMENTS) {
+        report(1, "Warning: Elements cannot be shared by threads with this "
+               "backend, skipping");
+        return true;
+    }
+
+    reclaim_sync();
+    size_t blocks = allocation_check();
+    bq_bench_t b = {.n = n, .producers = producers};
+    b.seen = calloc(n, sizeof(atomic_uchar));
+    b.bq = bq_new(BQ_CAPACITY);
+    if (!b.seen || !b.bq) {
+        report(1, "ERROR: Could not allocate the queue");
+        free(b.seen);
+        bq_free(b.bq);
+        return false;
+    }
+
+    pthread_t tid[2 * BQ_MAX_THREADS];
+    bq_worker_t worker[2 * BQ_MAX_THREADS];
+    bool ok = true;
+    int started_producers = 0, started_consumers = 0;
+    double start;
+
+    /* Looking every freed block up among thousands would dominate the run */
+    set_cautious_mode(false);
+    init_time(&start);
+    for (int i = 0; ok && i < consumers; i++) {
+        worker[i] = (bq_worker_t){.bench = &b, .id = i};
+        ok = !pthread_create(&tid[i], NULL, bq_consume, &worker[i]);
+        started_consumers += ok;
+    }
+    for (int i = 0; ok && i < producers; i++) {
+        worker[consumers + i] = (bq_worker_t){.bench = &b, .id = i};
+        ok = !pthread_create(&tid[consumers + i], NULL, bq_produce,
+                             &worker[consumers + i]);
+        started_producers += ok;
+    }
+    if (!ok)
+        report(1, "ERROR: Could not start %d threads", producers + consumers);
+
+    /* The consumers stop once the producers are done and the queue empty */
+    for (int i = 0; i < started_producers; i++)
+        pthread_join(tid[consumers + i], NULL);
+    bq_close(b.bq);
+    for (int i = 0; i < started_consumers; i++)
+        pthread_join(tid[i], NULL);
+    double elapsed = delta_time(&start);
+    set_cautious_mode(true);
+
+    long producer_waits, consumer_waits;
+    bq_waits(b.bq, &producer_waits, &consumer_waits);
+    bq_free(b.bq);
+    free(b.seen);
+
+    int sent = atomic_load(&b.sent), received = atomic_load(&b.received);
+    int errors = atomic_load(&b.errors);
+    if (ok && (errors || sent != received ||
+               sent + atomic_load(&b.failed) != n)) {
+        report(1, "ERROR: Sent %d strings, received %d, %d in error", sent,
+               received, errors);
+        ok = false;
+    }
+    if (allocation_check() != blocks) {
+        report(1, "ERROR: %ld blocks left allocated by the threads",
+               (long) (allocation_check() - blocks));
+        ok = false;
+    }
+    if (ok) {
+        report(2, "%d strings in %.3f s: %.2f M strings/s", received, elapsed,
+               mega_rate(received, elapsed));
+        report(2, "Producers waited %ld times, consumers %ld times",
+               producer_waits, consumer_waits);
+    }
+    return ok && !error_check();
+}
+
+static void pool_nop(void *arg)
+{
+    (void) arg;
+}
+
+/* Time n empty rounds on the pool, then show what each thread did */
+static bool do_pool(int argc, char *argv[])
+{
+    int n = 0;
+    if (argc > 2 || (argc == 2 && (!get_int(argv[1], &n) || n <= 0))) {
+        report(1, "%s takes an optional number of rounds", argv[0]);
+        return false;
+    }
+
+    if (n) {
+        pool_task_t tasks[POOL_MAX_THREADS];
+        int width = pool_threads;
+        if (width < 1)
+            width = 1;
+        if (width > POOL_MAX_THREADS)
+            width = POOL_MAX_THREADS;
+        for (int i = 0; i < width; i++)
+            tasks[i] = (pool_task_t){.func = pool_nop};
+
+        double start;
+        init_time(&start);
+        for (int i = 0; i < n; i++)
+            pool_run(tasks, width);
+        double elapsed = delta_time(&start);
+        report(2, "%d rounds of %d tasks in %.3f s: %.2f us per round", n,
+               width, elapsed, elapsed * 1e6 / n);
+    }
+
+    pool_stats_t stats[POOL_MAX_THREADS];
+    int threads = pool_stats(stats, POOL_MAX_THREADS);
+    if (!threads) {
+        report(1, "The pool is not started");
+        return true;
+    }
+    report(1, "%-8s %12s %12s %12s", "thread", "tasks", "steals", "idle");
+    for (int i = 0; i < threads; i++)
+        report(1, "%-8d %12ld %12ld %12ld", i, stats[i].tasks,
+               stats[i].steals, stats[i].idle);
+    return true;
+}
+
+static bool do_save(int argc, char *argv[])
+{
+    bool all = argc == 3 && !strcmp(argv[2], "all");
+    if (argc != 2 && !all) {
+        report(1, "%s needs a file name, optionally followed by 'all'",
+               argv[0]);
+        return false;
+    }
+
+    if (!current) {
+        report(3, "Warning: Calling save on null queue");
+        return !error_check();
+    }
+
+    int n = all ? chain.size : 1;
+    struct list_head **q = malloc(n * sizeof(struct list_head *));
+    if (!q) {
+        report(1, "ERROR: Could not allocate the list of queues");
+        return false;
+    }
+    if (all) {
+        int i = 0;
+        queue_contex_t *qctx;
+        list_for_each_entry (qctx, &chain.head, chain)
+            q[i++] = qctx->q;
+    } else {
+        q[0] = current->q;
+    }
+
+    bool ok = false;
+    error_check();
+    if (exception_setup(false)) {
+        ok = snapshot_save(argv[1], q, n);
+        if (!ok)
+            report(1, "ERROR: Could not save to %s: %s", argv[1],
+                   strerror(errno));
+    }
+    exception_cancel();
+    free(q);
+
+    if (ok)
+        report(2, "Saved %d queue%s to %s", n, n == 1 ? "" : "s", argv[1]);
+    return ok && !error_check();
+}
+
+static bool do_load(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs a file name", argv[0]);
+        return false;
+    }
+
+    snapshot_t snap;
+    if (!snapshot_open(&snap, argv[1])) {
+        report(1, "ERROR: Could not load %s: %s", argv[1], strerror(errno));
+        return false;
+    }
+
+    /* Every queue of the snapshot is loaded into a new one, as if created by
+     * the new command. Large snapshots may take longer than the time limit.
+     */
+    bool ok = true;
+    error_check();
+    for (uint32_t i = 0; ok && i < snap.queues; i++) {
+        if (exception_setup(false)) {
+            add_queue();
+            if (current->q &&
+                !snapshot_load(&snap, i, current->q, &current->size)) {
+                report(1, "ERROR: Could not load %s: %s", argv[1],
+                       strerror(errno));
+                ok = false;
+            }
+        } else {
+            ok = false;
+        }
+        exception_cancel();
+    }
+    snapshot_close(&snap);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+/* Load every queue of the snapshot at @path into @head */
+static bool snap_load_all(const char *path, struct list_head *head, int *count)
+{
+    snapshot_t snap;
+    if (!snapshot_open(&snap, path))
+        return false;
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < snap.queues; i++)
+        ok = snapshot_load(&snap, i, head, count);
+    snapshot_close(&snap);
+    return ok;
+}
+
+/* Write @size bytes of @buf to @path, replacing it */
+static bool snap_write(const char *path, const char *buf, size_t size)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(buf, 1, size, f) == size;
+    return !fclose(f) && ok;
+}
+
+/* Read all of @path into a new buffer, setting *@size */
+static char *snap_read(const char *path, size_t *size)
+{
+    struct stat st;
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    char *buf = NULL;
+    if (!fstat(fileno(f), &st) && (buf = malloc(st.st_size + 1)) &&
+        fread(buf, 1, st.st_size, f) != (size_t) st.st_size) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *size = st.st_size;
+    return buf;
+}
+
+/* Check that @size bytes of @buf, written to @path, do not load */
+static bool snap_refused(const char *path,
+                         const char *buf,
+                         size_t size,
+                         const char *what)
+{
+    struct list_head *q = q_new();
+    int count = 0;
+    bool ok = q && snap_write(path, buf, size);
+    if (ok && snap_load_all(path, q, &count)) {
+        report(1, "ERROR: Loaded a snapshot with %s", what);
+        ok = false;
+    } else if (!ok) {
+        report(1, "ERROR: Could not write a snapshot with %s", what);
+    }
+    q_free(q);
+    return ok;
+}
+
+/* Save n random strings and load them back, then check that snapshots cut
+ * short or corrupted are refused instead of loaded
+ */
+static bool do_snap(int argc, char *argv[])
+{
+    int n;
+    if (argc != 2 || !get_int(argv[1], &n) || n <= 0) {
+        report(1, "%s needs a number of strings", argv[0]);
+        return false;
+    }
+
+    char path[] = "/tmp/lab0-snap-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        report(1, "ERROR: Could not create a temporary file: %s",
+               strerror(errno));
+        return false;
+    }
+    close(fd);
+
+    struct list_head *q = q_new(), *loaded = q_new();
+    bool ok = q && loaded;
+    char buf[MAX_RANDSTR_LEN];
+    for (int i = 0; ok && i < n; i++) {
+        fill_rand_string(buf, sizeof(buf));
+        ok = q_insert_tail(q, buf);
+    }
+    if (!ok)
+        report(1, "ERROR: Could not allocate %d strings", n);
+
+    double start, saving, loading;
+    int count = 0;
+    if (ok) {
+        init_time(&start);
+        ok = snapshot_save(path, &q, 1);
+        saving = delta_time(&start);
+        init_time(&start);
+        ok = ok && snap_load_all(path, loaded, &count);
+        loading = delta_time(&start);
+        if (!ok)
+            report(1, "ERROR: Could not save and load %s: %s", path,
+                   strerror(errno));
+    }
+
+    bool same = ok && count == n;
+    struct list_head *a = q_next(q, q), *b = q_next(loaded, loaded);
+    for (; same && a != q; a = q_next(q, a), b = q_next(loaded, b)) {
+        same = b != loaded && !strcmp(list_entry(a, element_t, list)->value,
+                                      list_entry(b, element_t, list)->value);
+    }
+    if (ok && !same) {
+        report(1, "ERROR: Loaded strings differ from the saved ones");
+        ok = false;
+    } else if (ok) {
+        report(2, "%d strings saved in %.3f s, loaded in %.3f s", n, saving,
+               loading);
+    }
+
+    /* The first record is the length of the first string, then the string */
+    size_t size = 0, off = 0;
+    char *file = ok ? snap_read(path, &size) : NULL;
+    char *bad = file ? malloc(size + 1) : NULL;
+    if (ok && !bad) {
+        report(1, "ERROR: Could not read back %s", path);
+        ok = false;
+    }
+    if (ok) {
+        const char *first = list_first_entry(q, element_t, list)->value;
+        size_t len = strlen(first);
+        for (off = sizeof(uint32_t); off + len < size; off++) {
+            if (!memcmp(file + off, first, len + 1))
+                break;
+        }
+    }
+
+    ok = ok && snap_refused(path, file, size - 1, "its last byte cut");
+    ok = ok && snap_refused(path, file, size / 2, "half of it cut");
+    ok = ok && snap_refused(path, file, 0, "nothing in it");
+    if (ok) {
+        memcpy(bad, file, size);
+        bad[0] ^= 0xff;
+        ok = snap_refused(path, bad, size, "a wrong magic");
+    }
+    if (ok) {
+        memcpy(bad, file, size);
+        memset(bad + off - sizeof(uint32_t), 0xff, sizeof(uint32_t));
+        ok = snap_refused(path, bad, size, "a record past the end");
+    }
+    if (ok) {
+        memcpy(bad, file, size);
+        bad[off + 1] = '\0';
+        ok = snap_refused(path, bad, size, "a zero inside a string");
+    }
+
+    free(bad);
+    free(file);
+    unlink(path);
+    /* Looking every freed block up among thousands would dominate the run */
+    set_cautious_mode(false);
+    q_free(loaded);
+    q_free(q);
+    set_cautious_mode(true);
+    return ok && !error_check();
+}
+
+static bool do_mapq(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs a file name", argv[0]);
+        return false;
+    }
+
+    /* The lines go into a new queue. Large files may take longer than the
+     * time limit.
+     */
+    bool ok = false;
+    error_check();
+    if (exception_setup(false)) {
+        add_queue();
+        if (current->q) {
+            ok = mapq_load(current->q, argv[1], &current->size);
+            if (!ok)
+                report(1, "ERROR: Could not map %s: %s", argv[1],
+                       strerror(errno));
+        }
+    }
+    exception_cancel();
+
+    q_show(3);
+    return ok && !error_check();
+}
+
 static bool do_dm(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -703,12 +1896,12 @@ static bool do_descend(int argc, char *argv[])
 
     cnt = current->size;
     if (current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
+        for (struct list_head *cur_l = q_next(current->q, current->q);
+             cur_l != current->q && --cnt; cur_l = q_next(current->q, cur_l)) {
             element_t *item, *next_item;
             item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) < 0) {
+            next_item = list_entry(q_next(current->q, cur_l), element_t, list);
+            if (element_cmp(item, next_item) < 0) {
                 report(1,
                        "ERROR: At least one node violated the ordering rule");
                 ok = false;
@@ -771,7 +1964,7 @@ static bool do_merge(int argc, char *argv[])
     exception_cancel();
     set_noallocate_mode(false);
 
-    if (q_size(&chain.head) > 1) {
+    if (chain.size > 1) {
         chain.size = 1;
         current = list_entry(chain.head.next, queue_contex_t, chain);
         current->size = len;
@@ -790,13 +1983,13 @@ static bool do_merge(int argc, char *argv[])
 
     bool ok = true;
     if (current && current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --len; cur_l = cur_l->next) {
+        for (struct list_head *cur_l = q_next(current->q, current->q);
+             cur_l != current->q && --len; cur_l = q_next(current->q, cur_l)) {
             /* Ensure each element in ascending order */
             element_t *item, *next_item;
             item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) > 0) {
+            next_item = list_entry(q_next(current->q, cur_l), element_t, list);
+            if (element_cmp(item, next_item) > 0) {
                 report(1,
                        "ERROR: Not sorted in ascending order (It might because "
                        "of unsorted queues are merged or there're some flaws "
@@ -811,6 +2004,146 @@ static bool do_merge(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Most queues the kmerge command merges */
+#define KMERGE_MAX_QUEUES 4096
+
+/* Free the queues of contexts @ctx[0] to @ctx[k - 1] */
+static void kmerge_free(queue_contex_t *ctx, int k)
+{
+    for (int i = 0; i < k; i++) {
+        q_free(ctx[i].q);
+        ctx[i].q = NULL;
+    }
+}
+
+/* Chain @k sorted queues holding @n random strings between them, then as
+ * many copies of them, for a second merge to check the first against
+ */
+static bool kmerge_build(struct list_head *chain,
+                         struct list_head *copies,
+                         queue_contex_t *ctx,
+                         int k,
+                         int n)
+{
+    char buf[MAX_RANDSTR_LEN];
+    INIT_LIST_HEAD(chain);
+    INIT_LIST_HEAD(copies);
+    for (int i = 0; i < 2 * k; i++) {
+        ctx[i] = (queue_contex_t){.q = q_new(), .id = i};
+        if (!ctx[i].q)
+            return false;
+        list_add_tail(&ctx[i].chain, i < k ? chain : copies);
+    }
+
+    for (int i = 0; i < k; i++) {
+        for (int j = i; j < n; j += k) {
+            fill_rand_string(buf, sizeof(buf));
+            if (!q_insert_tail(ctx[i].q, buf))
+                return false;
+            ctx[i].size++;
+        }
+        q_sort(ctx[i].q);
+
+        struct list_head *head = ctx[i].q, *node;
+        for (node = q_next(head, head); node != head;
+             node = q_next(head, node)) {
+            if (!q_insert_tail(ctx[k + i].q,
+                               list_entry(node, element_t, list)->value))
+                return false;
+            ctx[k + i].size++;
+        }
+    }
+    return true;
+}
+
+/* Whether two merges of @k queues of @n strings in all gave the same queue,
+ * and left every size right
+ */
+static bool kmerge_check(queue_contex_t *ctx, int k, int n)
+{
+    for (int i = 1; i < k; i++) {
+        if (ctx[i].size || q_size(ctx[i].q) || ctx[k + i].size ||
+            q_size(ctx[k + i].q))
+            return false;
+    }
+    if (ctx[0].size != n || q_size(ctx[0].q) != n || ctx[k].size != n ||
+        q_size(ctx[k].q) != n)
+        return false;
+
+    struct list_head *a = ctx[0].q, *b = ctx[k].q;
+    struct list_head *x = q_next(a, a), *y = q_next(b, b);
+    const char *prev = "";
+    for (; x != a; x = q_next(a, x), y = q_next(b, y)) {
+        const char *value = list_entry(x, element_t, list)->value;
+        if (strcmp(value, list_entry(y, element_t, list)->value) ||
+            strcmp(prev, value) > 0)
+            return false;
+        prev = value;
+    }
+    return true;
+}
+
+/* Merge n strings spread over 8, 16... up to k queues, on one thread and then
+ * on the pool, and compare the times and results
+ */
+static bool do_kmerge(int argc, char *argv[])
+{
+    int n, max = 256;
+    if (argc < 2 || argc > 3 || !get_int(argv[1], &n) || n < 0 ||
+        (argc == 3 && (!get_int(argv[2], &max) || max < 1 ||
+                       max > KMERGE_MAX_QUEUES))) {
+        report(1, "%s needs a number of strings, then up to %d queues",
+               argv[0], KMERGE_MAX_QUEUES);
+        return false;
+    }
+
+    queue_contex_t *ctx = calloc(2 * max, sizeof(queue_contex_t));
+    if (!ctx) {
+        report(1, "ERROR: Could not allocate %d queues", 2 * max);
+        return false;
+    }
+
+    int threads = pool_threads;
+    bool ok = true;
+    /* Looking every freed block up among millions would dominate the run */
+    set_cautious_mode(false);
+    for (int k = max < 8 ? max : 8; ok && k <= max; k *= 2) {
+        struct list_head chain_one, chain_pool;
+        ok = kmerge_build(&chain_one, &chain_pool, ctx, k, n);
+        if (!ok) {
+            report(1, "ERROR: Could not build %d queues", 2 * k);
+            kmerge_free(ctx, 2 * k);
+            break;
+        }
+
+        double start, one, on_pool;
+        pool_threads = 1;
+        init_time(&start);
+        q_merge(&chain_one);
+        one = delta_time(&start);
+        pool_threads = threads;
+        init_time(&start);
+        q_merge(&chain_pool);
+        on_pool = delta_time(&start);
+
+        ok = kmerge_check(ctx, k, n);
+        if (ok)
+            report(2,
+                   "k = %4d: %.3f s on 1 thread, %.3f s on %d threads, "
+                   "speedup %.2f",
+                   k, one, on_pool, threads,
+                   on_pool > 0 ? one / on_pool : 0.0);
+        else
+            report(1, "ERROR: Merging %d queues on %d threads differs", k,
+                   threads);
+        kmerge_free(ctx, 2 * k);
+    }
+    set_cautious_mode(true);
+    pool_threads = threads;
+    free(ctx);
+    return ok && !error_check();
+}
+
 static bool is_circular()
 {
     struct list_head *cur = current->q->next;
@@ -849,13 +2182,14 @@ static bool q_show(int vlevel)
     report_noreturn(vlevel, "l = [");
 
     struct list_head *ori = current->q;
-    struct list_head *cur = current->q->next;
+    struct list_head *cur = q_next(current->q, current->q);
 
     if (exception_setup(true)) {
         while (ok && ori != cur && cnt < current->size) {
             element_t *e = list_entry(cur, element_t, list);
             if (cnt < BIG_LIST_SIZE) {
-                report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
+                report_noreturn(vlevel, cnt == 0 ? "%.*s" : " %.*s",
+                                (int) element_len(e), e->value);
                 if (show_entropy) {
                     report_noreturn(
                         vlevel, "(%3.2f%%)",
@@ -863,7 +2197,7 @@ static bool q_show(int vlevel)
                 }
             }
             cnt++;
-            cur = cur->next;
+            cur = q_next(current->q, cur);
             ok = ok && !error_check();
         }
     }
@@ -952,6 +2286,8 @@ static void console_init()
 {
     ADD_COMMAND(new, "Create new queue", "");
     ADD_COMMAND(free, "Delete queue", "");
+    ADD_COMMAND(sync, "Wait until queues deleted in the background are freed",
+                "");
     ADD_COMMAND(prev, "Switch to previous queue", "");
     ADD_COMMAND(next, "Switch to next queue", "");
     ADD_COMMAND(ih,
@@ -970,13 +2306,59 @@ static void console_init()
         rt,
         "Remove from tail of queue. Optionally compare to expected value str",
         "[str]");
+    ADD_COMMAND(rhn,
+                "Remove k elements from head of queue at once, or all of "
+                "them if k is omitted",
+                "[k]");
     ADD_COMMAND(reverse, "Reverse queue", "");
     ADD_COMMAND(sort, "Sort queue in ascending order", "");
+    ADD_COMMAND(xsort,
+                "Sort n random strings with the external sort, without "
+                "storing them in a queue",
+                "n");
+    ADD_COMMAND(save,
+                "Save queue to file, or all queues if 'all' is given, as a "
+                "binary snapshot",
+                "file [all]");
+    ADD_COMMAND(load, "Load the queues of a snapshot file as new queues",
+                "file");
+    ADD_COMMAND(snap,
+                "Save n random strings and load them back, checking that "
+                "damaged snapshots are refused",
+                "n");
+    ADD_COMMAND(mapq,
+                "Map the lines of a text file into a new queue without "
+                "copying them",
+                "file");
+    ADD_COMMAND(mpmc,
+                "Pass n elements through the lock-free queue with 1, 2, 4... "
+                "up to t producers and as many consumers",
+                "n [t]");
+    ADD_COMMAND(pipe,
+                "Pass n elements from a producer thread to a consumer thread "
+                "through the wait-free queue, b at a time",
+                "n [b]");
+    ADD_COMMAND(ring,
+                "Put n random strings through the ring deque, checking it "
+                "against a queue",
+                "n");
+    ADD_COMMAND(bq,
+                "Pass n strings from p producer threads to c consumer "
+                "threads through the blocking queue",
+                "n [p [c]]");
+    ADD_COMMAND(pool,
+                "Run n empty rounds on the thread pool, then show what each "
+                "of its threads did",
+                "[n]");
     ADD_COMMAND(size, "Compute queue size n times (default: n == 1)", "[n]");
     ADD_COMMAND(show, "Show queue contents", "");
     ADD_COMMAND(dm, "Delete middle node in queue", "");
     ADD_COMMAND(dedup, "Delete all nodes that have duplicate string", "");
     ADD_COMMAND(merge, "Merge all the queues into one sorted queue", "");
+    ADD_COMMAND(kmerge,
+                "Merge n strings spread over 8, 16... up to k queues on one "
+                "thread, then on the thread pool",
+                "n [k]");
     ADD_COMMAND(swap, "Swap every two adjacent nodes in queue", "");
     ADD_COMMAND(descend,
                 "Remove every node which has a node with a strictly greater "
@@ -990,6 +2372,15 @@ static void console_init()
               NULL);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
+    add_param("sort", &sort_mode,
+              "Sorting algorithm (0: merge, 1: radix, 2: external)", NULL);
+    add_param("threads", &pool_threads,
+              "Number of threads used by parallel operations", NULL);
+    add_param("reclaim", &reclaim_async,
+              "Free the elements of deleted queues on a background thread",
+              NULL);
+    add_param("sortmem", &sort_memory, "Memory in KiB used by external sort",
+              NULL);
 }
 
 /* Signal handlers */
@@ -1039,6 +2430,8 @@ static bool q_quit(int argc, char *argv[])
 
     exception_cancel();
     set_cautious_mode(true);
+    pool_stop();
+    reclaim_stop();
 
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
@@ -2,7 +2,17 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "mapq.h"
+#include "pool.h"
 #include "queue.h"
+#include "reclaim.h"
+#include "sort.h"
+#ifdef QUEUE_INTERN
+#include "intern.h"
+#endif
+#ifdef QUEUE_BACKEND_UNROLLED
+#include "unrolled.h"
+#endif
 
 /* Notice: sometimes, Cppcheck would find the potential NULL pointer bugs,
  * but some of them cannot occur. You can suppress them by adding the
@@ -10,118 +20,456 @@
  *   cppcheck-suppress nullPointer
  */
 
+/* Bookkeeping of a queue. The list head must stay in first position, since
+ * the rest of the program only deals with the struct list_head pointer.
+ */
+typedef struct {
+    struct list_head head;
+    bool reversed;   /* Read the list from tail to head, see q_reverse() */
+    int size;        /* Number of elements */
+    int run;         /* Elements at the front known to be in ascending order */
+    bool descending; /* All elements are known to be strictly descending */
+#ifdef QUEUE_BACKEND_UNROLLED
+    struct list_head chunks;
+#endif
+} queue_t;
+
+static inline queue_t *queue_of(struct list_head *head)
+{
+    return container_of(head, queue_t, head);
+}
+
+/* Flip the links of every node of @head, including the header itself */
+static void reverse_list(struct list_head *head)
+{
+    struct list_head *node = head;
+    do {
+        struct list_head *tmp = node->next;
+        node->next = node->prev;
+        node->prev = tmp;
+        node = tmp;
+    } while (node != head);
+}
+
+/* Node after @node in the order the queue is presented in */
+static inline struct list_head *next_of(struct list_head *head,
+                                        struct list_head *node)
+{
+    return queue_of(head)->reversed ? node->prev : node->next;
+}
+
+static inline struct list_head *prev_of(struct list_head *head,
+                                        struct list_head *node)
+{
+    return queue_of(head)->reversed ? node->next : node->prev;
+}
+
+/* Apply a pending reversal to the links, before an operation which walks the
+ * list in order
+ */
+static void settle(struct list_head *head)
+{
+    queue_t *q = queue_of(head);
+    if (q->reversed) {
+        reverse_list(head);
+        q->reversed = false;
+    }
+}
+
+/* Link the list @batch in at the head or tail of queue, keeping its order */
+static void splice_at(struct list_head *head,
+                      struct list_head *batch,
+                      bool at_tail)
+{
+    if (queue_of(head)->reversed) {
+        reverse_list(batch);
+        at_tail = !at_tail;
+    }
+    if (at_tail)
+        list_splice_tail(batch, head);
+    else
+        list_splice(batch, head);
+}
+
+/* Whether the whole queue is known to be in ascending order */
+static inline bool known_sorted(const queue_t *q)
+{
+    return q->run == q->size;
+}
+
+/* Account for @n elements equal to @entry about to be linked in at the head or
+ * tail of queue. Only the element they are put next to is compared.
+ */
+static void track_insert(struct list_head *head,
+                         const element_t *entry,
+                         int n,
+                         bool at_tail)
+{
+    queue_t *q = queue_of(head);
+    if (!n)
+        return;
+
+    if (!q->size) {
+        q->run = n;
+        q->descending = true;
+    } else if (at_tail) {
+        const element_t *last =
+            list_entry(prev_of(head, head), element_t, list);
+        int cmp = element_cmp(last, entry);
+        if (known_sorted(q) && cmp <= 0)
+            q->run += n;
+        q->descending = q->descending && cmp > 0;
+    } else {
+        const element_t *first =
+            list_entry(next_of(head, head), element_t, list);
+        int cmp = element_cmp(entry, first);
+        q->run = cmp <= 0 ? q->run + n : n;
+        q->descending = q->descending && cmp > 0;
+    }
+    /* Copies of one string are equal to each other */
+    if (n > 1)
+        q->descending = false;
+    q->size += n;
+}
+
+/* Account for @n elements removed, @front of them from the known run. What is
+ * left of the run is still in order.
+ */
+static void track_remove(queue_t *q, int n, int front)
+{
+    q->size -= n;
+    q->run -= front;
+    if (!q->run && q->size)
+        q->run = 1;
+}
+
+/* The elements were rearranged in an order which is not tracked */
+static void track_shuffle(queue_t *q)
+{
+    q->run = q->size ? 1 : 0;
+    q->descending = false;
+}
+
+int sort_mode = SORT_MERGE;
 
 /* Create an empty queue */
 struct list_head *q_new()
 {
-    struct list_head *head = malloc(sizeof(struct list_head));
-    INIT_LIST_HEAD(head);
-    return head;
+    queue_t *q = malloc(sizeof(queue_t));
+    if (!q)
+        return NULL;
+
+    INIT_LIST_HEAD(&q->head);
+    q->reversed = false;
+    q->size = 0;
+    q->run = 0;
+    q->descending = false;
+#ifdef QUEUE_BACKEND_UNROLLED
+    INIT_LIST_HEAD(&q->chunks);
+#endif
+    return &q->head;
 }
 
 /* Free all storage used by queue */
 void q_free(struct list_head *l)
 {
-    if (!list_empty(l)) {
-        struct list_head *node, *safe;
-        list_for_each_safe (node, safe, l) {
-            element_t *entry = list_entry(node, element_t, list);
-            q_release_element(entry);
-        }
-    }
-    free(l);
-    return;
+    if (!l)
+        return;
+
+#if !defined(QUEUE_BACKEND_UNROLLED) && !defined(QUEUE_INTERN)
+    /* Leave the elements to the reclaimer, unless some are mapped. Those
+     * it does not take are released below.
+     */
+    if (reclaim_async && !mapq_files)
+        reclaim_defer(l);
+#endif
+    element_t *entry, *safe;
+    list_for_each_entry_safe (entry, safe, l, list)
+        q_release_element(entry);
+#ifdef QUEUE_BACKEND_UNROLLED
+    unrolled_free(&queue_of(l)->chunks);
+#endif
+    free(queue_of(l));
 }
 
-element_t *element_new(const char *s)
+static element_t *element_new(struct list_head *head, const char *s)
 {
+#ifdef QUEUE_BACKEND_UNROLLED
+    element_t *entry = unrolled_element_new(&queue_of(head)->chunks, s);
+    if (!entry)
+        return NULL;
+#else
     element_t *entry = malloc(sizeof(element_t));
-    if (entry == NULL)
+    if (!entry)
+        return NULL;
+
+#ifdef QUEUE_INTERN
+    entry->value = intern_get(s);
+#else
+    entry->value = strdup(s);
+#endif
+    if (!entry->value) {
+        free(entry);
         return NULL;
-    size_t buflen = strlen(s) + 1;
-    entry->value = malloc(sizeof(char) * buflen);
-    strncpy(entry->value, s, buflen);
+    }
+#endif
+    entry->key = key_of(s);
+    entry->mapped = false;
     return entry;
 }
 
+#ifndef QUEUE_BACKEND_UNROLLED
+/* Mapped elements go back to their file, the others to the heap */
+void q_release_element(element_t *e)
+{
+    if (e->mapped) {
+        mapq_release(e);
+        return;
+    }
+#ifdef QUEUE_INTERN
+    intern_put(e->value);
+#else
+    free(e->value);
+#endif
+    free(e);
+}
+#endif
+
 /* Insert an element at head of queue */
 bool q_insert_head(struct list_head *head, char *s)
 {
-    if (head == NULL)
+    if (!head)
         return false;
 
-    element_t *entry = element_new(s);
-    if (entry == NULL)
+    element_t *entry = element_new(head, s);
+    if (!entry)
         return false;
 
-    list_add(&entry->list, head);
-    if (list_empty(head))
-        return false;
+    track_insert(head, entry, 1, false);
+    if (queue_of(head)->reversed)
+        list_add_tail(&entry->list, head);
+    else
+        list_add(&entry->list, head);
     return true;
 }
 
 /* Insert an element at tail of queue */
 bool q_insert_tail(struct list_head *head, char *s)
 {
-    if ((head == NULL) || list_empty(head))
+    if (!head)
         return false;
 
-    element_t *entry = element_new(s);
-    if (entry == NULL)
+    element_t *entry = element_new(head, s);
+    if (!entry)
         return false;
 
-    list_add_tail(&entry->list, head);
-    if (list_empty(head))
-        return false;
+    track_insert(head, entry, 1, true);
+    if (queue_of(head)->reversed)
+        list_add(&entry->list, head);
+    else
+        list_add_tail(&entry->list, head);
     return true;
 }
 
-/* Remove an element from head of queue */
-element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
+/* Create up to @n elements holding @s and link them in order on @list.
+ * Return the number created, which is less than @n if allocation failed.
+ */
+static int element_new_n(struct list_head *head,
+                         struct list_head *list,
+                         const char *s,
+                         int n)
+{
+    int count = 0;
+    for (; count < n; count++) {
+        element_t *entry = element_new(head, s);
+        if (!entry)
+            break;
+        list_add_tail(&entry->list, list);
+    }
+    return count;
+}
+
+/* Insert @n elements at head of queue */
+int q_insert_head_n(struct list_head *head, const char *s, int n)
+{
+    if (!head || n <= 0)
+        return 0;
+
+    LIST_HEAD(list);
+    int count = element_new_n(head, &list, s, n);
+    if (count)
+        track_insert(head, list_first_entry(&list, element_t, list), count,
+                     false);
+    splice_at(head, &list, false);
+    return count;
+}
+
+/* Insert @n elements at tail of queue */
+int q_insert_tail_n(struct list_head *head, const char *s, int n)
+{
+    if (!head || n <= 0)
+        return 0;
+
+    LIST_HEAD(list);
+    int count = element_new_n(head, &list, s, n);
+    if (count)
+        track_insert(head, list_first_entry(&list, element_t, list), count,
+                     true);
+    splice_at(head, &list, true);
+    return count;
+}
+
+/* Link an element of the caller in at tail of queue */
+void q_adopt_tail(struct list_head *head, element_t *e)
+{
+    if (!head || !e)
+        return;
+
+    e->key = key_of(e->value);
+    track_insert(head, e, 1, true);
+    if (queue_of(head)->reversed)
+        list_add(&e->list, head);
+    else
+        list_add_tail(&e->list, head);
+}
+
+/* Detach the element from head of queue */
+element_t *q_pop_head(struct list_head *head)
 {
     if (head == NULL || list_empty(head))
         return NULL;
 
-    element_t *entry = list_first_entry(head, element_t, list);
+    element_t *entry = list_entry(next_of(head, head), element_t, list);
     list_del(&entry->list);
-    if (sp != NULL) {
-        strncpy(sp, entry->value, bufsize - 1);
-        sp[bufsize - 1] = '\0';
-    }
-
+    track_remove(queue_of(head), 1, 1);
     return entry;
 }
 
-/* Remove an element from tail of queue */
-element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
+/* Detach the element from tail of queue */
+element_t *q_pop_tail(struct list_head *head)
 {
     if (head == NULL || list_empty(head))
         return NULL;
 
-    element_t *entry = list_last_entry(head, element_t, list);
+    queue_t *q = queue_of(head);
+    element_t *entry = list_entry(prev_of(head, head), element_t, list);
     list_del(&entry->list);
-    if (sp != NULL) {
-        strncpy(sp, entry->value, bufsize - 1);
-        sp[bufsize - 1] = '\0';
-    }
+    track_remove(q, 1, known_sorted(q));
+    return entry;
+}
+
+/* Copy the string of @entry to @sp, up to @bufsize - 1 characters. Unlike
+ * strncpy(), the rest of the buffer is not padded with zeros.
+ */
+static void copy_value(char *sp, size_t bufsize, const element_t *entry)
+{
+    if (!sp || !bufsize)
+        return;
+
+    size_t len = strnlen(entry->value, bufsize - 1);
+    const char *nl = entry->mapped ? memchr(entry->value, '\n', len) : NULL;
+    if (nl)
+        len = nl - entry->value;
+    memcpy(sp, entry->value, len);
+    sp[len] = '\0';
+}
+
+/* Remove an element from head of queue */
+element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
+{
+    element_t *entry = q_pop_head(head);
+    if (entry)
+        copy_value(sp, bufsize, entry);
+    return entry;
+}
 
+/* Remove an element from tail of queue */
+element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
+{
+    element_t *entry = q_pop_tail(head);
+    if (entry)
+        copy_value(sp, bufsize, entry);
     return entry;
 }
 
+/* Detach up to @k elements from head of queue onto @out */
+int q_remove_head_n(struct list_head *head, int k, struct list_head *out)
+{
+    if (!head || !out || k <= 0)
+        return 0;
+
+    struct list_head *node = head;
+    int count = 0;
+    for (; count < k && next_of(head, node) != head; count++) {
+        node = next_of(head, node);
+    }
+
+    LIST_HEAD(batch);
+    if (!queue_of(head)->reversed) {
+        list_cut_position(&batch, head, node);
+    } else {
+        /* The batch is the end of the list from @node on. Cut off what
+         * precedes it, take the rest and put the front back.
+         */
+        LIST_HEAD(front);
+        list_cut_position(&front, head, node->prev);
+        list_splice_init(head, &batch);
+        list_splice(&front, head);
+        reverse_list(&batch);
+    }
+    track_remove(queue_of(head), count,
+                 count < queue_of(head)->run ? count : queue_of(head)->run);
+    list_splice_tail(&batch, out);
+    return count;
+}
+
+/* Move all elements of queue onto @out */
+void q_drain(struct list_head *head, struct list_head *out)
+{
+    if (!head || !out)
+        return;
+
+    settle(head);
+    list_splice_tail_init(head, out);
+    queue_of(head)->size = 0;
+    track_shuffle(queue_of(head));
+}
+
+/* Move the @n elements of @list to tail of queue */
+void q_splice_tail(struct list_head *head, struct list_head *list, int n)
+{
+    if (!head || !list || list_empty(list))
+        return;
+
+    /* The batch is not compared with anything, so only the run already
+     * known at the front stays known
+     */
+    queue_t *q = queue_of(head);
+    q->size += n;
+    if (!q->run)
+        q->run = 1;
+    q->descending = false;
+    splice_at(head, list, true);
+    INIT_LIST_HEAD(list);
+}
+
 /* Return number of elements in queue */
 int q_size(struct list_head *head)
 {
-    int size = 0;
-    if (head == NULL || list_empty(head))
+    if (head == NULL)
         return 0;
-    else if (list_is_singular(head))
-        return 1;
-    else {
-        struct list_head *node;
-        list_for_each (node, head)
-            size++;
-    }
-    return size;
+    return queue_of(head)->size;
+}
+
+/* Step through queue in the order its elements are presented in */
+struct list_head *q_next(struct list_head *head, struct list_head *node)
+{
+    return next_of(head, node);
+}
+
+struct list_head *q_prev(struct list_head *head, struct list_head *node)
+{
+    return prev_of(head, node);
 }
 
 /* Delete the middle node in queue */
@@ -130,51 +478,54 @@ bool q_delete_mid(struct list_head *head)
     if (head == NULL || list_empty(head))
         return false;
 
-    int mid = (q_size(head) + 1) / 2;
-    struct list_head *node;
-    list_for_each (node, head) {
-        if (--mid == 0) {
-            element_t *del_entry = list_entry(node, element_t, list);
-            list_del(node);
-            q_release_element(del_entry);
-            break;
-        }
+    queue_t *q = queue_of(head);
+    track_remove(q, 1, q->size / 2 < q->run);
+
+    /* Walk in from both ends until the walkers meet. With an even number of
+     * nodes they stop side by side, and the middle is the one coming from
+     * the tail of the queue.
+     */
+    struct list_head *fwd = head->next, *bwd = head->prev;
+    while (fwd != bwd && fwd->next != bwd) {
+        fwd = fwd->next;
+        bwd = bwd->prev;
     }
+    struct list_head *mid = q->reversed ? fwd : bwd;
+    element_t *del_entry = list_entry(mid, element_t, list);
+    list_del(mid);
+    q_release_element(del_entry);
     return true;
 }
 
 /* Delete all nodes that have duplicate string */
 bool q_delete_dup(struct list_head *head)
 {
-    if (head == NULL || list_empty(head) || list_is_singular(head))
+    if (!head)
         return false;
 
-    struct list_head *head_node = head->next, *head_safe;
-    struct list_head *node, *safe;
-    bool isDup = false;
-
-    while (head_node != head && head_node->next != head) {
-        element_t *head_entry = list_entry(head_node, element_t, list);
-        list_for_each_safe (node, safe, head_node) {
-            safe = node->next;
-            element_t *entry = list_entry(node, element_t, list);
-            if (!strcmp(head_entry->value, entry->value)) {
-                list_del(node);
-                q_release_element(entry);
-                isDup = true;
-            }
-            if (safe == head)
-                break;
-        }
-
-        head_safe = head_node->next;
-        if (isDup) {
-            list_del(head_node);
-            q_release_element(head_entry);
-            isDup = false;
+    /* Duplicates are runs of equal neighbours, as in a sorted queue, so one
+     * pass comparing each node with the next finds all of them.
+     */
+    queue_t *q = queue_of(head);
+    element_t *entry, *safe;
+    bool dup = false;
+    int pos = 0, removed = 0, front = 0;
+    list_for_each_entry_safe (entry, safe, head, list) {
+        bool next_dup = &safe->list != head && element_eq(entry, safe);
+        if (dup || next_dup) {
+            /* Count the removed elements of the known run, by their
+             * position in the order the queue is presented in
+             */
+            if ((q->reversed ? q->size - 1 - pos : pos) < q->run)
+                front++;
+            removed++;
+            list_del(&entry->list);
+            q_release_element(entry);
         }
-        head_node = head_safe;
+        dup = next_dup;
+        pos++;
     }
+    track_remove(q, removed, front);
     return true;
 }
 
@@ -184,6 +535,8 @@ void q_swap(struct list_head *head)
     if (head == NULL || list_empty(head) || list_is_singular(head))
         return;
 
+    settle(head);
+    track_shuffle(queue_of(head));
     struct list_head *node = head->next, *next_node = head->next->next;
     while (node != head && next_node != head) {
         struct list_head *_prev = node->prev;
@@ -208,97 +561,66 @@ void q_reverse(struct list_head *head)
     if (head == NULL || list_empty(head) || list_is_singular(head))
         return;
 
-    struct list_head *tmp = head->next;
-    head->next = head->prev;
-    head->prev = tmp;
-
-    struct list_head *node;
-    list_for_each (node, head) {
-        tmp = node->next;
-        node->next = node->prev;
-        node->prev = tmp;
-    }
-    return;
+    /* Only flip the direction. The links are flipped by the next operation
+     * that walks the list in order, if any.
+     */
+    /* Whether an ascending queue holds equal elements is not tracked, so it
+     * is not known to be strictly descending once reversed
+     */
+    queue_t *q = queue_of(head);
+    q->reversed = !q->reversed;
+    q->run = q->descending ? q->size : 1;
+    q->descending = false;
 }
 
 /* Reverse the nodes of the list k at a time */
 void q_reverseK(struct list_head *head, int k)
 {
-    // https://leetcode.com/problems/reverse-nodes-in-k-group/
-    if (!head || list_empty(head) || list_is_singular(head))
-        return;
-    if (k <= 1 || k > q_size(head))
+    if (!head || k <= 1)
         return;
-    /*
-    struct list_head *curr = head->next, *last = head;
-    struct list_head *grp_start = NULL;
-    struct list_head *grp_end = NULL;
-    int cnt = 0;
-    while (curr != head) {
-        printf("[%s]\n", list_entry(curr, element_t, list)->value);
-        if (cnt%k == 0) {
-            if (cnt/k != 0) {
-                // reverse last k element
-
-                struct list_head *local_curr = grp_start;//, *itr_curr =
-    grp_start;
-                //struct list_head *end = grp_end;//, *itr_curr = grp_start;
-                while (local_curr != grp_end){//} && grp_end != grp_start) {
-                    struct list_head *tmp = local_curr;
-                    local_curr->prev = tmp->next;
-                    local_curr->next = tmp->prev;
-
-                    //struct list_head *tmp = local_curr->next->next;
-                    //local_curr->next = local_curr->prev;
-                    //local_curr->next->next = local_curr;
-                    //local_curr->prev = tmp->prev;
-                    local_curr = local_curr->prev;
-                }
-
-                // update last
-                last = grp_start;
-                printf("296 leave while last_ele = %s\n", list_entry(last,
-    element_t, list)->value); grp_end->next = curr; //curr; printf("289
-    grp_end(%s)->next = curr(%s)\n", list_entry(grp_end, element_t,
-    list)->value, list_entry(curr, element_t, list)->value);
-
-            }
-            grp_start = curr;
-        }
-        else if(cnt%k == k-1){
-            grp_end = curr;
-            last->next = grp_end;
-        }
 
-        curr = curr->next;
-        cnt++;
+    /* Cut every full group off the front, reverse it on its own and append
+     * it to @done. Fewer than k nodes are left at the end, in their order.
+     */
+    settle(head);
+    LIST_HEAD(done);
+    LIST_HEAD(group);
+    struct list_head *node, *safe;
+    int count = 0;
+    list_for_each_safe (node, safe, head) {
+        if (++count < k)
+            continue;
+        list_cut_position(&group, head, node);
+        reverse_list(&group);
+        list_splice_tail_init(&group, &done);
+        count = 0;
     }
+    list_splice_init(&done, head);
+    if (k <= queue_of(head)->size)
+        track_shuffle(queue_of(head));
+}
 
-    int tmpcnt = 0;
-    while(head->next!=head && tmpcnt<10){
-        printf("%s->", list_entry(head->next, element_t, list)->value);
-        tmpcnt++;
+/* Sort the settled queue @head, whose first @known elements are in order */
+static void sort_queue(struct list_head *head, int known)
+{
+    if (sort_mode == SORT_EXTERNAL) {
+        /* The alarm may stop the sort with the queue in any order */
+        track_shuffle(queue_of(head));
+        if (sort_list_external(head, (size_t) sort_memory << 10))
+            return;
+        /* Sort in memory instead, from the order the failure left */
+        known = 0;
     }
-    printf("\n\n");
-
-    // update head->prev
-    printf("312 - curr->next(%s), curr->prev(%s)\n",
-                        list_entry(curr->prev, element_t, list)->value,
-                        list_entry(curr->next, element_t, list)->value);
-
-    head->prev = cnt%k == k-1 ? curr->prev : grp_start;
-    curr->next = head;
-    printf("312 - head->prev(%s)\n", list_entry(head->prev, element_t,
-    list)->value); printf("3122 - head->next(%s)\n", list_entry(head->next,
-    element_t, list)->value);
 
+    if (sort_mode == SORT_RADIX || pool_threads > 1) {
+        sort_list_parallel(head,
+                           sort_mode == SORT_RADIX ? radix_sort : natural_sort,
+                           pool_threads);
+        return;
+    }
 
-    //struct list_head *itr = head->next;
-    //while(itr!=head){
-    //    printf("[%s]", list_entry(itr, element_t, list)->value);
-    //}
-    */
-    return;
+    /* The natural merge sort does not compare the known run again */
+    sort_list_natural(head, known);
 }
 
 /* Sort elements of queue in ascending order */
@@ -307,82 +629,102 @@ void q_sort(struct list_head *head)
     if (head == NULL || list_empty(head) || list_is_singular(head))
         return;
 
-    /* Selection Sort */
-    struct list_head *node;
-    element_t *local_min_element;
-    int n_sorted = 0;
-    int size = q_size(head);
-    while (n_sorted != size) {
-        int i = 0;
-        local_min_element = list_first_entry(head, element_t, list);
-        list_for_each (node, head) {
-            if (i == size - n_sorted)
-                break;
-            element_t *local_element = list_entry(node, element_t, list);
-            local_min_element =
-                strcmp(local_element->value, local_min_element->value) <= 0
-                    ? local_element
-                    : local_min_element;
-            i++;
-        }
-        list_move_tail(&local_min_element->list, head);
-        n_sorted++;
+    queue_t *q = queue_of(head);
+    if (known_sorted(q))
+        return;
+    if (q->descending) {
+        /* No two elements are equal, so reversing keeps the sort stable */
+        q_reverse(head);
+        return;
     }
-    return;
+
+    settle(head);
+    sort_queue(head, q->run);
+    q->run = q->size;
+    q->descending = false;
 }
 
 /* Remove every node which has a node with a strictly greater value anywhere to
  * the right side of it */
 int q_descend(struct list_head *head)
 {
-    if (!head || list_empty(head) || list_is_singular(head))
-        return q_size(head);
+    if (!head || list_empty(head))
+        return 0;
 
-    struct list_head *node, *safe;
-    list_for_each_safe (node, safe, head) {
-        safe = node->next;
+    /* Walk backward keeping the greatest element seen so far. A node less
+     * than it has a strictly greater node on its right side.
+     */
+    queue_t *q = queue_of(head);
+    element_t *max = list_entry(prev_of(head, head), element_t, list);
+    int size = 1, front = 0;
+    bool strict = true;
+    struct list_head *node, *prev;
+    int pos = q->size - 2;
+    for (node = prev_of(head, &max->list); node != head; node = prev, pos--) {
+        prev = prev_of(head, node);
         element_t *entry = list_entry(node, element_t, list);
-        bool hasGreater = false;
-        struct list_head *tail_node = head->prev;
-        while (tail_node != node) {
-            element_t *tail_entry = list_entry(tail_node, element_t, list);
-            if (strcmp(tail_entry->value, entry->value)) {
-                hasGreater = true;
-                break;
-            }
-            tail_node = tail_node->prev;
-        }
-        if (hasGreater) {
+        int cmp = element_cmp(entry, max);
+        if (cmp < 0) {
+            if (pos < q->run)
+                front++;
             list_del(node);
             q_release_element(entry);
+        } else {
+            strict = strict && cmp > 0;
+            max = entry;
+            size++;
         }
     }
-    return q_size(head);
+    track_remove(q, q->size - size, front);
+    q->descending = strict;
+    return size;
 }
 
-void show_list(struct list_head *head)
+/* Merge the sorted list @src into the sorted list @dst, leaving @src empty.
+ * Elements of @dst go first among equal ones, so the merge is stable.
+ */
+static void merge_two(struct list_head *dst, struct list_head *src)
 {
-    printf("show_list:\n");
-    struct list_head *node;
-    list_for_each (node, head) {
-        element_t *entry = list_entry(node, element_t, list);
-        printf("\t%s\n", entry->value);
+    LIST_HEAD(result);
+    while (!list_empty(dst) && !list_empty(src)) {
+        element_t *a = list_first_entry(dst, element_t, list);
+        element_t *b = list_first_entry(src, element_t, list);
+        list_move_tail(element_cmp(a, b) <= 0 ? &a->list : &b->list, &result);
     }
+    list_splice_tail_init(src, &result);
+    list_splice_init(&result, dst);
 }
-void show_chain(struct list_head *head)
-{
-    printf("show_chain:\n");
-    struct list_head *chain_node;
-    list_for_each (chain_node, head) {
-        queue_contex_t *context = list_entry(chain_node, queue_contex_t, chain);
-        printf("context-> size = %d, context->id = %d\n", context->size,
-               context->id);
-        struct list_head *node;
-        list_for_each (node, context->q) {
-            element_t *entry = list_entry(node, element_t, list);
-            printf("\t%s\n", entry->value);
-        }
-    }
+
+/* Pairs of queues merged by one round of the pool in q_merge() */
+#define MERGE_BATCH 64
+
+/* Merge the queue of @arg[1] into that of @arg[0], an earlier one in the
+ * chain. Only the two queues are touched, so pairs are merged concurrently.
+ */
+static void merge_pair(void *arg)
+{
+    queue_contex_t **pair = arg;
+    struct list_head *head = pair[0]->q, *other = pair[1]->q;
+    queue_t *dst = queue_of(head), *src = queue_of(other);
+    bool sorted = known_sorted(dst) && known_sorted(src);
+
+    settle(head);
+    settle(other);
+    merge_two(head, other);
+    dst->size += src->size;
+    src->size = 0;
+    track_shuffle(src);
+#ifdef QUEUE_BACKEND_UNROLLED
+    /* The moved elements live in chunks of the other queue */
+    list_splice_tail_init(&src->chunks, &dst->chunks);
+#endif
+    pair[0]->size += pair[1]->size;
+    pair[1]->size = 0;
+
+    /* The result is only known to be sorted if the queues were */
+    track_shuffle(dst);
+    if (sorted)
+        dst->run = dst->size;
 }
 
 /* Merge all the queues into one sorted queue, which is in ascending order */
@@ -391,71 +733,38 @@ int q_merge(struct list_head *head)
     if (!head || list_empty(head))
         return 0;
 
-    queue_contex_t *target_context =
-        list_first_entry(head, queue_contex_t, chain);
-    if (list_is_singular(head))
-        return q_size(target_context->q);
-
-    printf("[original data]\n");
-    show_chain(head);
-
-    printf("[target head]\n");
-    show_list(target_context->q);
-    while (!list_is_singular(head)) {
-        show_chain(head);
-        // find min in second to last chain
-        struct list_head *chain_head = head->next->next;
-        queue_contex_t *chain_context =
-            list_entry(chain_head, queue_contex_t, chain);
-        queue_contex_t *min_context =
-            list_entry(chain_head, queue_contex_t, chain);
-        element_t *min_entry =
-            list_first_entry(chain_context->q, element_t, list);
-        struct list_head *min_chain_head = chain_head;
-        while (chain_head != head) {
-            chain_context = list_entry(chain_head, queue_contex_t, chain);
-            element_t *entry =
-                list_first_entry(chain_context->q, element_t, list);
-            printf("entry = %s\n", entry->value);
-            if (strcmp(entry->value, min_entry->value) <= 0) {
-                min_entry = entry;
-                min_context = list_entry(chain_head, queue_contex_t, chain);
-                min_chain_head = chain_head;
-                printf("remove entry -----> %s\n", min_entry->value);
-            }
-            chain_head = chain_head->next;
-        }
-
-        // remove min_node
-        // check q_context size of min_entry
-        list_del_init(&min_entry->list);
-        min_context->size -= 1;
-        if (min_context->size == 0) {
-            list_del_init(min_chain_head);
-        }
-
-        // insert to queue of target chain
-        struct list_head *node;
-        list_for_each (node, target_context->q) {
-            element_t *entry = list_entry(node, element_t, list);
-            printf("entry value = %s\n", entry->value);
-            if (strcmp(list_entry(node, element_t, list)->value,
-                       min_entry->value) > 0) {
-                printf("inserted node value = %s\n",
-                       list_entry(node, element_t, list)->value);
-                struct list_head temp_head;
-                INIT_LIST_HEAD(&temp_head);
-                list_cut_position(&temp_head, target_context->q, node->prev);
-                list_add_tail(&min_entry->list, &temp_head);
-                list_splice_init(&temp_head, target_context->q);
-
-                printf("[temp_head]\n");
-                show_list(&temp_head);
-                printf("[target head]\n");
-                show_list(target_context->q);
-                break;
+    queue_contex_t *ctx;
+    int count = 0;
+    list_for_each_entry (ctx, head, chain)
+        count += !!ctx->q;
+
+    /* Merge in rounds, each queue taking in the one @stride queues after it,
+     * so that every queue goes through log2(count) merges. Equal elements
+     * keep the order of their queues in the chain, which makes the result
+     * the same as merging the queues one after the other.
+     */
+    queue_contex_t *pair[MERGE_BATCH][2];
+    pool_task_t tasks[MERGE_BATCH];
+    for (int stride = 1; stride < count; stride *= 2) {
+        int pos = 0, n = 0;
+        queue_contex_t *dst = NULL;
+        list_for_each_entry (ctx, head, chain) {
+            if (!ctx->q)
+                continue;
+            if (pos % (2 * stride) == 0) {
+                dst = ctx;
+            } else if (pos % (2 * stride) == stride) {
+                pair[n][0] = dst;
+                pair[n][1] = ctx;
+                tasks[n] = (pool_task_t){.func = merge_pair, .arg = pair[n]};
+                if (++n == MERGE_BATCH) {
+                    pool_run(tasks, n);
+                    n = 0;
+                }
             }
+            pos++;
         }
+        pool_run(tasks, n);
     }
-    return q_size(target_context->q);
+    return list_first_entry(head, queue_contex_t, chain)->size;
 }
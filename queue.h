@@ -9,6 +9,8 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "harness.h"
 #include "list.h"
@@ -16,12 +18,18 @@
 /**
  * element_t - Linked list element
  * @value: pointer to array holding string
+ * @key: first 8 bytes of @value in big-endian order, zero padded
+ * @mapped: @value is a line of a file mapped by mapq_load(), ending at its
+ *          newline instead of a terminator, see mapq.h
  * @list: node of a doubly-linked list
  *
- * @value needs to be explicitly allocated and freed
+ * @value needs to be explicitly allocated and freed. @key is set on insertion
+ * so that most comparisons are decided without loading @value.
  */
 typedef struct {
     char *value;
+    uint64_t key;
+    bool mapped;
     struct list_head list;
 } element_t;
 
@@ -78,6 +86,42 @@ bool q_insert_head(struct list_head *head, char *s);
  */
 bool q_insert_tail(struct list_head *head, char *s);
 
+/**
+ * q_insert_head_n() - Insert elements holding the same string in the head
+ * @head: header of queue
+ * @s: string would be inserted
+ * @n: number of elements to insert
+ *
+ * Same as calling q_insert_head() @n times, except that the new elements are
+ * linked into the queue with a single splice.
+ *
+ * Return: the number of elements inserted, less than @n if allocation failed,
+ * zero if queue is NULL
+ */
+int q_insert_head_n(struct list_head *head, const char *s, int n);
+
+/**
+ * q_insert_tail_n() - Insert elements holding the same string at the tail
+ * @head: header of queue
+ * @s: string would be inserted
+ * @n: number of elements to insert
+ *
+ * Return: the number of elements inserted, less than @n if allocation failed,
+ * zero if queue is NULL
+ */
+int q_insert_tail_n(struct list_head *head, const char *s, int n);
+
+/**
+ * q_adopt_tail() - Link an element built by the caller in at the tail
+ * @head: header of queue
+ * @e: element whose value and mapped are set, to be released by
+ *      q_release_element()
+ *
+ * Lets elements come from storage other than the one q_insert_tail() uses,
+ * such as the files mapped by mapq_load(). The string is not copied.
+ */
+void q_adopt_tail(struct list_head *head, element_t *e);
+
 /**
  * q_remove_head() - Remove the element from head of queue
  * @head: header of queue
@@ -108,17 +152,67 @@ element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize);
  */
 element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
 
+/**
+ * q_pop_head() - Detach the element from head of queue without copying
+ * @head: header of queue
+ *
+ * Like q_remove_head(), but the string is left in the element. The caller
+ * owns the element, value included, and releases it with q_release_element().
+ *
+ * Return: the pointer to element, %NULL if queue is NULL or empty.
+ */
+element_t *q_pop_head(struct list_head *head);
+
+/**
+ * q_pop_tail() - Detach the element from tail of queue without copying
+ * @head: header of queue
+ *
+ * Return: the pointer to element, %NULL if queue is NULL or empty.
+ */
+element_t *q_pop_tail(struct list_head *head);
+
+/**
+ * q_remove_head_n() - Remove elements from head of queue at once
+ * @head: header of queue
+ * @k: maximum number of elements to remove
+ * @out: list the removed elements are appended to, in queue order
+ *
+ * Strings are not copied. The caller owns the removed elements and releases
+ * them with q_release_element().
+ *
+ * Return: the number of elements removed, which is less than @k if the queue
+ * is shorter, zero if queue or @out is NULL
+ */
+int q_remove_head_n(struct list_head *head, int k, struct list_head *out);
+
+/**
+ * q_drain() - Remove all elements of queue in constant time
+ * @head: header of queue
+ * @out: list the removed elements are appended to, in queue order
+ *
+ * No effect if queue or @out is NULL. The caller owns the removed elements.
+ * Takes linear time if a reversal by q_reverse() is still pending.
+ */
+void q_drain(struct list_head *head, struct list_head *out);
+
+/**
+ * q_splice_tail() - Move a list of elements to the tail of queue
+ * @head: header of queue
+ * @list: elements to move, in order, left empty
+ * @n: number of elements in @list
+ *
+ * Takes constant time, like q_drain(), unless a reversal by q_reverse() is
+ * pending. The elements must come from queues, such as by q_drain().
+ */
+void q_splice_tail(struct list_head *head, struct list_head *list, int n);
+
 /**
  * q_release_element() - Release the element
  * @e: element would be released
  *
  * This function is intended for internal use only.
  */
-static inline void q_release_element(element_t *e)
-{
-    test_free(e->value);
-    test_free(e);
-}
+void q_release_element(element_t *e);
 
 /**
  * q_size() - Get the size of the queue
@@ -128,13 +222,35 @@ static inline void q_release_element(element_t *e)
  */
 int q_size(struct list_head *head);
 
+/**
+ * q_next() - Get the next node of queue in the order q_reverse() left it in
+ * @head: header of queue
+ * @node: node of queue, or @head to get the first node
+ *
+ * q_reverse() may only record that the queue is reversed, in which case the
+ * elements are linked from tail to head. Code walking the list of a queue
+ * directly steps with q_next() and q_prev() instead of the list links.
+ *
+ * Return: the node after @node, @head after the last node
+ */
+struct list_head *q_next(struct list_head *head, struct list_head *node);
+
+/**
+ * q_prev() - Get the previous node of queue in the order q_reverse() left it in
+ * @head: header of queue
+ * @node: node of queue, or @head to get the last node
+ *
+ * Return: the node before @node, @head before the first node
+ */
+struct list_head *q_prev(struct list_head *head, struct list_head *node);
+
 /**
  * q_delete_mid() - Delete the middle node in queue
  * @head: header of queue
  *
  * The middle node of a linked list of size n is the
  * ⌊n / 2⌋th node from the start using 0-based indexing.
- * If there're six elements, the third member should be returned.
+ * If there're six elements, the fourth member should be returned.
  *
  * Reference:
  * https://leetcode.com/problems/delete-the-middle-node-of-a-linked-list/
@@ -172,6 +288,9 @@ void q_swap(struct list_head *head);
  * This function should not allocate or free any list elements
  * (e.g., by calling q_insert_head, q_insert_tail, or q_remove_head).
  * It should rearrange the existing ones.
+ *
+ * Runs in constant time: it flips the direction in which the queue is read,
+ * and the links are rearranged by the next operation that needs them in order.
  */
 void q_reverse(struct list_head *head);
 
@@ -196,6 +315,11 @@ void q_reverseK(struct list_head *head, int k);
  *
  * No effect if queue is NULL or empty. If there has only one element, do
  * nothing.
+ *
+ * The queue keeps track of how much of it is known to be in order as it is
+ * modified. Sorting takes constant time if all of it is known to be in
+ * ascending or descending order, and close to linear time if it is nearly
+ * sorted. The algorithm is picked by sort_mode, see sort.h.
  */
 void q_sort(struct list_head *head);
 
@@ -0,0 +1,138 @@
+#include <pthread.h>
+#include <signal.h>
+
+#include "queue.h"
+#include "reclaim.h"
+
+/**
+ * reclaim - The reclaimer
+ * @lock: guards the other fields
+ * @work: signaled when elements are handed over or the thread has to stop
+ * @idle: broadcast when the thread runs out of elements
+ * @pending: elements handed over, not yet taken by the thread
+ * @tid: the thread, valid while @started
+ * @started: the thread is running
+ * @busy: the thread is freeing a batch
+ * @stop: the thread has to exit once @pending is empty
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t idle;
+    struct list_head pending;
+    pthread_t tid;
+    bool started;
+    bool busy;
+    bool stop;
+} reclaim = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER,
+    .pending = {&reclaim.pending, &reclaim.pending},
+};
+
+int reclaim_async = 0;
+
+/* Take everything pending as one batch, and free it without the lock. The
+ * lists of blocks the batch is in are borrowed from the harness first, so
+ * that the blocks are unlinked and freed here rather than pushed back to the
+ * console thread. They go back once nothing is pending.
+ */
+static void *reclaim_main(void *arg)
+{
+    (void) arg;
+
+    pthread_mutex_lock(&reclaim.lock);
+    for (;;) {
+        if (list_empty(&reclaim.pending)) {
+            test_give_back();
+            reclaim.busy = false;
+            pthread_cond_broadcast(&reclaim.idle);
+            if (reclaim.stop)
+                break;
+            pthread_cond_wait(&reclaim.work, &reclaim.lock);
+            continue;
+        }
+
+        LIST_HEAD(batch);
+        list_splice_init(&reclaim.pending, &batch);
+        reclaim.busy = true;
+        pthread_mutex_unlock(&reclaim.lock);
+        test_borrow();
+
+        element_t *entry, *safe;
+        list_for_each_entry_safe (entry, safe, &batch, list) {
+            test_free_deferred(entry->value);
+            test_free_deferred(entry);
+        }
+        pthread_mutex_lock(&reclaim.lock);
+    }
+    pthread_mutex_unlock(&reclaim.lock);
+    return NULL;
+}
+
+/* The lock is never held with signals open, since the alarm of the harness
+ * jumps back to the command loop
+ */
+static void lock_masked(sigset_t *old)
+{
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, old);
+    pthread_mutex_lock(&reclaim.lock);
+}
+
+static void unlock_masked(const sigset_t *old)
+{
+    pthread_mutex_unlock(&reclaim.lock);
+    pthread_sigmask(SIG_SETMASK, old, NULL);
+}
+
+bool reclaim_defer(struct list_head *list)
+{
+    if (list_empty(list))
+        return true;
+
+    sigset_t old;
+    lock_masked(&old);
+    /* Started with all signals blocked, which the thread keeps */
+    if (!reclaim.started)
+        reclaim.started =
+            !pthread_create(&reclaim.tid, NULL, reclaim_main, NULL);
+    bool ok = reclaim.started;
+    if (ok) {
+        test_lend();
+        list_splice_tail_init(list, &reclaim.pending);
+        pthread_cond_signal(&reclaim.work);
+    }
+    unlock_masked(&old);
+    return ok;
+}
+
+void reclaim_sync(void)
+{
+    sigset_t old;
+    lock_masked(&old);
+    while (reclaim.started &&
+           (reclaim.busy || !list_empty(&reclaim.pending)))
+        pthread_cond_wait(&reclaim.idle, &reclaim.lock);
+    unlock_masked(&old);
+}
+
+void reclaim_stop(void)
+{
+    sigset_t old;
+    lock_masked(&old);
+    bool started = reclaim.started;
+    if (started) {
+        reclaim.stop = true;
+        pthread_cond_signal(&reclaim.work);
+    }
+    unlock_masked(&old);
+    if (!started)
+        return;
+
+    pthread_join(reclaim.tid, NULL);
+    reclaim.started = false;
+    reclaim.stop = false;
+}
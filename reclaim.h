@@ -0,0 +1,41 @@
+#ifndef LAB0_RECLAIM_H
+#define LAB0_RECLAIM_H
+
+/* Background reclamation of the elements of freed queues.
+ *
+ * With "option reclaim 1" in qtest, q_free() detaches the elements of the
+ * queue in O(1) and hands them to a reclaimer thread, which frees them in
+ * batches while the console goes on. The console lends the harness lists of
+ * its blocks along, so the reclaimer unlinks and frees the blocks itself. reclaim_sync() waits for everything
+ * handed over so far, as the sync command and quitting do before counting
+ * the blocks left allocated.
+ *
+ * Elements are only handed over where another thread may release them: not
+ * with the unrolled backend or interned strings, whose storage is shared
+ * without locking, nor while a mapped file lends its strings to queues.
+ */
+
+#include <stdbool.h>
+
+#include "list.h"
+
+/* Whether q_free() defers to the reclaimer, "option reclaim" in qtest */
+extern int reclaim_async;
+
+/**
+ * reclaim_defer() - Hand elements over to the reclaimer
+ * @list: header of a list of element_t, left empty
+ *
+ * Starts the reclaimer on first use.
+ *
+ * Return: false if the reclaimer could not be started, leaving @list as is
+ */
+bool reclaim_defer(struct list_head *list);
+
+/* Wait until every element handed over so far is freed */
+void reclaim_sync(void);
+
+/* Wait for the reclaimer, then stop it. The next deferral starts it again */
+void reclaim_stop(void);
+
+#endif /* LAB0_RECLAIM_H */
@@ -71,12 +71,15 @@ void report_event(message_t msg, char *fmt, ...)
     if (!errfile)
         init_files(stdout, stdout);
 
+    /* Keep the line whole when threads report at once */
+    flockfile(errfile);
     va_start(ap, fmt);
     fprintf(errfile, "%s: ", msg_name);
     vfprintf(errfile, fmt, ap);
     fprintf(errfile, "\n");
     fflush(errfile);
     va_end(ap);
+    funlockfile(errfile);
 
     if (logfile) {
         va_start(ap, fmt);
@@ -0,0 +1,190 @@
+#include <string.h>
+
+#include "ring.h"
+#include "sort.h"
+
+/**
+ * struct ring - Circular array of element pointers
+ * @slot: the array
+ * @mask: number of slots minus one
+ * @first: slot of the head
+ * @count: number of elements
+ * @reversed: the elements follow the head backward in @slot
+ */
+struct ring {
+    element_t **slot;
+    size_t mask;
+    size_t first;
+    size_t count;
+    bool reversed;
+};
+
+/* Slot of the element at index @i from the head */
+static inline size_t slot_of(const ring_t *r, size_t i)
+{
+    return (r->reversed ? r->first - i : r->first + i) & r->mask;
+}
+
+ring_t *ring_new(size_t capacity)
+{
+    size_t cap = 2;
+    while (cap < capacity)
+        cap <<= 1;
+
+    ring_t *r = malloc(sizeof(ring_t));
+    if (!r)
+        return NULL;
+    r->slot = malloc(cap * sizeof(element_t *));
+    if (!r->slot) {
+        free(r);
+        return NULL;
+    }
+    r->mask = cap - 1;
+    r->first = 0;
+    r->count = 0;
+    r->reversed = false;
+    return r;
+}
+
+void ring_free(ring_t *r)
+{
+    if (!r)
+        return;
+    free(r->slot);
+    free(r);
+}
+
+size_t ring_size(const ring_t *r)
+{
+    return r->count;
+}
+
+/* Move the elements in order to the start of @slot, of @cap slots */
+static void relocate(ring_t *r, element_t **slot, size_t cap)
+{
+    for (size_t i = 0; i < r->count; i++)
+        slot[i] = r->slot[slot_of(r, i)];
+    free(r->slot);
+    r->slot = slot;
+    r->mask = cap - 1;
+    r->first = 0;
+    r->reversed = false;
+}
+
+/* Make room for one more element */
+static bool reserve(ring_t *r)
+{
+    if (r->count <= r->mask)
+        return true;
+
+    size_t cap = 2 * (r->mask + 1);
+    element_t **slot = malloc(cap * sizeof(element_t *));
+    if (!slot)
+        return false;
+    relocate(r, slot, cap);
+    return true;
+}
+
+bool ring_push_head(ring_t *r, element_t *e)
+{
+    if (!reserve(r))
+        return false;
+    r->first = (r->reversed ? r->first + 1 : r->first - 1) & r->mask;
+    r->slot[r->first] = e;
+    r->count++;
+    return true;
+}
+
+bool ring_push_tail(ring_t *r, element_t *e)
+{
+    if (!reserve(r))
+        return false;
+    r->slot[slot_of(r, r->count)] = e;
+    r->count++;
+    return true;
+}
+
+element_t *ring_pop_head(ring_t *r)
+{
+    if (!r->count)
+        return NULL;
+    element_t *e = r->slot[r->first];
+    r->first = slot_of(r, 1);
+    r->count--;
+    return e;
+}
+
+element_t *ring_pop_tail(ring_t *r)
+{
+    if (!r->count)
+        return NULL;
+    return r->slot[slot_of(r, --r->count)];
+}
+
+element_t *ring_at(const ring_t *r, size_t i)
+{
+    return r->slot[slot_of(r, i)];
+}
+
+element_t *ring_remove_at(ring_t *r, size_t i)
+{
+    element_t *e = ring_at(r, i);
+    if (i < r->count / 2) {
+        /* Shift the elements before @i toward the tail */
+        for (size_t j = i; j > 0; j--)
+            r->slot[slot_of(r, j)] = r->slot[slot_of(r, j - 1)];
+        r->first = slot_of(r, 1);
+    } else {
+        for (size_t j = i + 1; j < r->count; j++)
+            r->slot[slot_of(r, j - 1)] = r->slot[slot_of(r, j)];
+    }
+    r->count--;
+    return e;
+}
+
+void ring_reverse(ring_t *r)
+{
+    if (r->count)
+        r->first = slot_of(r, r->count - 1);
+    r->reversed = !r->reversed;
+}
+
+bool ring_sort(ring_t *r)
+{
+    size_t n = r->count, cap = r->mask + 1;
+    element_t **a = malloc(cap * sizeof(element_t *));
+    element_t **b = malloc((n ? n : 1) * sizeof(element_t *));
+    if (!a || !b) {
+        free(a);
+        free(b);
+        return false;
+    }
+    relocate(r, a, cap);
+
+    /* Merge runs of @width from @a into @b, then swap the two. On ties the
+     * element of the left run goes first.
+     */
+    for (size_t width = 1; width < n; width *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2 * width) {
+            size_t mid = lo + width < n ? lo + width : n;
+            size_t hi = mid + width < n ? mid + width : n;
+            size_t i = lo, j = mid, k = lo;
+            while (i < mid && j < hi)
+                b[k++] = element_cmp(a[j], a[i]) < 0 ? a[j++] : a[i++];
+            memcpy(b + k, a + i, (mid - i) * sizeof(element_t *));
+            k += mid - i;
+            memcpy(b + k, a + j, (hi - j) * sizeof(element_t *));
+        }
+        element_t **t = a;
+        a = b;
+        b = t;
+    }
+
+    /* The sorted run may have ended up in the smaller buffer */
+    if (a != r->slot) {
+        memcpy(r->slot, a, n * sizeof(element_t *));
+        b = a;
+    }
+    free(b);
+    return true;
+}
@@ -0,0 +1,82 @@
+#ifndef LAB0_RING_H
+#define LAB0_RING_H
+
+/* Growable deque of elements with O(1) access by position.
+ *
+ * A power-of-two circular array of element pointers, doubled when it fills
+ * up, so inserting at either end takes amortized O(1). An element is found
+ * by its index in O(1), and removing it shifts the shorter side over the
+ * gap. Reversing only flips the direction in which the array is read.
+ *
+ * Elements are not owned: they stay linked in whatever queue they belong to,
+ * and ring_free() leaves them alone.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+typedef struct ring ring_t;
+
+/**
+ * ring_new() - Create an empty deque
+ * @capacity: number of elements it holds before growing, rounded up to a
+ *            power of two
+ *
+ * Return: NULL for allocation failed
+ */
+ring_t *ring_new(size_t capacity);
+
+void ring_free(ring_t *r);
+
+size_t ring_size(const ring_t *r);
+
+/**
+ * ring_push_head() - Insert an element at the head
+ * @r: the deque
+ * @e: element to insert
+ *
+ * Return: false if the deque was full and could not grow
+ */
+bool ring_push_head(ring_t *r, element_t *e);
+
+/* Insert an element at the tail, like ring_push_head() */
+bool ring_push_tail(ring_t *r, element_t *e);
+
+/* Remove the element at the head, or NULL if the deque is empty */
+element_t *ring_pop_head(ring_t *r);
+
+/* Remove the element at the tail, or NULL if the deque is empty */
+element_t *ring_pop_tail(ring_t *r);
+
+/* Element at index @i from the head, which must be less than the size */
+element_t *ring_at(const ring_t *r, size_t i);
+
+/**
+ * ring_remove_at() - Remove the element at an index
+ * @r: the deque
+ * @i: index from the head, less than the size
+ *
+ * Takes O(min(@i, size - @i)) moves of pointers. ring_remove_at(r, size / 2)
+ * is q_delete_mid() without the walk to the middle.
+ *
+ * Return: the element removed
+ */
+element_t *ring_remove_at(ring_t *r, size_t i);
+
+/* Swap head and tail in O(1) */
+void ring_reverse(ring_t *r);
+
+/**
+ * ring_sort() - Sort the elements in ascending order of their strings
+ * @r: the deque
+ *
+ * A stable bottom-up merge sort of the pointers, on element_cmp() like
+ * q_sort(), so both give equal elements the same order.
+ *
+ * Return: false if the buffers could not be allocated, leaving @r as it was
+ */
+bool ring_sort(ring_t *r);
+
+#endif /* LAB0_RING_H */
@@ -11,7 +11,8 @@
 double shannon_entropy(const uint8_t *s)
 {
     assert(s);
-    const uint64_t count = strlen((char *) s);
+    /* Lines of mapped files end at their newline */
+    const uint64_t count = strcspn((const char *) s, "\n");
     uint64_t entropy_sum = 0;
     const uint64_t entropy_max = 8 * LOG2_RET_SHIFT;
 
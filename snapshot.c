@@ -0,0 +1,248 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+#include "sort.h"
+
+#define SNAPSHOT_MAGIC "lab0snap"
+#define SNAPSHOT_VERSION 1
+
+/* Strings written per writev(), three vectors each. Linux takes up to 1024 */
+#define WRITE_BATCH 256
+
+/* Offsets buffered before being written to an index */
+#define INDEX_BATCH 4096
+
+/**
+ * header_t - Start of a snapshot
+ * @magic: SNAPSHOT_MAGIC, without terminator
+ * @version: SNAPSHOT_VERSION
+ * @queues: number of queues
+ * @table: file offset of the table of queues
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t queues;
+    uint64_t table;
+} header_t;
+
+/**
+ * table_t - Entry of the table of queues
+ * @count: number of strings of the queue
+ * @index: file offset of the array of @count record offsets
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t index;
+} table_t;
+
+/* Write all of @iov, going on after partial writes */
+static bool write_vec(int fd, struct iovec *iov, int cnt)
+{
+    while (cnt) {
+        ssize_t ret = writev(fd, iov, cnt);
+        if (ret < 0)
+            return false;
+        for (; cnt && (size_t) ret >= iov->iov_len; iov++, cnt--)
+            ret -= iov->iov_len;
+        if (cnt) {
+            iov->iov_base = (char *) iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+    struct iovec iov = {.iov_base = (void *) buf, .iov_len = len};
+    return write_vec(fd, &iov, 1);
+}
+
+/* Write the records of queue @head, pointing the vectors at the strings
+ * themselves. Terminators are written apart, as mapped lines end at newlines.
+ */
+static bool save_records(int fd, struct list_head *head)
+{
+    static const char zero = '\0';
+    struct iovec iov[3 * WRITE_BATCH];
+    uint32_t len[WRITE_BATCH];
+    int n = 0;
+
+    if (!head)
+        return true;
+    for (struct list_head *node = q_next(head, head); node != head;
+         node = q_next(head, node)) {
+        const element_t *entry = list_entry(node, element_t, list);
+        len[n] = element_len(entry);
+        iov[3 * n] = (struct iovec){&len[n], sizeof(uint32_t)};
+        iov[3 * n + 1] = (struct iovec){entry->value, len[n]};
+        iov[3 * n + 2] = (struct iovec){(void *) &zero, 1};
+        if (++n == WRITE_BATCH) {
+            if (!write_vec(fd, iov, 3 * n))
+                return false;
+            n = 0;
+        }
+    }
+    return !n || write_vec(fd, iov, 3 * n);
+}
+
+/* Write the index of queue @head, whose records start at *@off. Advance
+ * *@off past them.
+ */
+static bool save_index(int fd, struct list_head *head, uint64_t *off)
+{
+    uint64_t index[INDEX_BATCH];
+    int n = 0;
+
+    if (!head)
+        return true;
+    for (struct list_head *node = q_next(head, head); node != head;
+         node = q_next(head, node)) {
+        index[n] = *off;
+        *off += sizeof(uint32_t) +
+                element_len(list_entry(node, element_t, list)) + 1;
+        if (++n == INDEX_BATCH) {
+            if (!write_all(fd, index, sizeof(index)))
+                return false;
+            n = 0;
+        }
+    }
+    return !n || write_all(fd, index, n * sizeof(uint64_t));
+}
+
+bool snapshot_save(const char *path, struct list_head *const *q, int n)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    /* Leave room for the header, written once everything else is */
+    header_t header = {.version = SNAPSHOT_VERSION, .queues = n};
+    bool ok = lseek(fd, sizeof(header_t), SEEK_SET) == sizeof(header_t);
+    for (int i = 0; ok && i < n; i++)
+        ok = save_records(fd, q[i]);
+
+    /* The indexes follow the records, then the table */
+    uint64_t off = sizeof(header_t);
+    for (int i = 0; ok && i < n; i++)
+        ok = save_index(fd, q[i], &off);
+    for (int i = 0; ok && i < n; i++) {
+        table_t entry = {.count = q_size(q[i]), .index = off};
+        off += entry.count * sizeof(uint64_t);
+        ok = write_all(fd, &entry, sizeof(entry));
+    }
+    header.table = off;
+
+    if (ok) {
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        ok = pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+    }
+
+    int err = errno;
+    if (close(fd) && ok) {
+        ok = false;
+        err = errno;
+    }
+    errno = err;
+    return ok;
+}
+
+bool snapshot_open(snapshot_t *snap, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return false;
+    }
+    if ((size_t) st.st_size < sizeof(header_t)) {
+        close(fd);
+        errno = EINVAL;
+        return false;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        errno = err;
+        return false;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    header_t header;
+    memcpy(&header, map, sizeof(header));
+    uint64_t table_end =
+        header.table + (uint64_t) header.queues * sizeof(table_t);
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) ||
+        header.version != SNAPSHOT_VERSION || header.table > table_end ||
+        table_end > (uint64_t) st.st_size) {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return false;
+    }
+
+    snap->map = map;
+    snap->size = st.st_size;
+    snap->queues = header.queues;
+    snap->table = header.table;
+    return true;
+}
+
+bool snapshot_load(const snapshot_t *snap,
+                   uint32_t i,
+                   struct list_head *head,
+                   int *count)
+{
+    table_t entry;
+    memcpy(&entry, snap->map + snap->table + i * sizeof(table_t),
+           sizeof(entry));
+    if (entry.index > snap->size ||
+        entry.count > (snap->size - entry.index) / sizeof(uint64_t)) {
+        errno = EINVAL;
+        return false;
+    }
+
+    /* Check every record against the size of the file before handing its
+     * string over, straight from the mapping. A zero inside the string would
+     * silently cut it short.
+     */
+    const char *index = snap->map + entry.index;
+    for (uint64_t n = 0; n < entry.count; n++) {
+        uint64_t off;
+        uint32_t len;
+        memcpy(&off, index + n * sizeof(uint64_t), sizeof(off));
+        if (off > snap->size || snap->size - off < sizeof(uint32_t) + 1) {
+            errno = EINVAL;
+            return false;
+        }
+        memcpy(&len, snap->map + off, sizeof(len));
+        off += sizeof(uint32_t);
+        if (snap->size - off <= len || snap->map[off + len] ||
+            memchr(snap->map + off, '\0', len)) {
+            errno = EINVAL;
+            return false;
+        }
+        if (!q_insert_tail(head, (char *) snap->map + off)) {
+            errno = ENOMEM;
+            return false;
+        }
+        (*count)++;
+    }
+    return true;
+}
+
+void snapshot_close(snapshot_t *snap)
+{
+    munmap((void *) snap->map, snap->size);
+}
@@ -0,0 +1,75 @@
+#ifndef LAB0_SNAPSHOT_H
+#define LAB0_SNAPSHOT_H
+
+/* Binary snapshots of queues, behind the save and load commands of qtest.
+ *
+ * A snapshot starts with a header, followed by the strings of all queues
+ * as records: a 32-bit length, the bytes and a terminating zero. Then come
+ * an index per queue, holding the file offset of each of its records, and a
+ * table giving the number of strings and the index of each queue. Integers
+ * are stored in host byte order.
+ *
+ * The header is written last, so an interrupted save does not leave a file
+ * which loads. Loading maps the file and inserts the strings straight from
+ * the mapping.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "queue.h"
+
+/**
+ * snapshot_t - Snapshot mapped for loading
+ * @map: the file contents
+ * @size: size of @map
+ * @queues: number of queues in the snapshot
+ * @table: offset in @map of the table of queues
+ */
+typedef struct {
+    const char *map;
+    size_t size;
+    uint32_t queues;
+    uint64_t table;
+} snapshot_t;
+
+/**
+ * snapshot_save() - Write queues to a snapshot
+ * @path: file to write, created or truncated
+ * @q: heads of the queues, NULL ones being saved as empty
+ * @n: number of queues
+ *
+ * Return: false with errno set if writing failed
+ */
+bool snapshot_save(const char *path, struct list_head *const *q, int n);
+
+/**
+ * snapshot_open() - Map a snapshot and check its header
+ * @snap: set to the mapped snapshot
+ * @path: file to read
+ *
+ * Return: false with errno set if the file could not be mapped, EINVAL if it
+ * is not a snapshot
+ */
+bool snapshot_open(snapshot_t *snap, const char *path);
+
+/**
+ * snapshot_load() - Insert the strings of a queue of a snapshot
+ * @snap: snapshot opened by snapshot_open()
+ * @i: position of the queue in the snapshot
+ * @head: queue the strings are inserted at the tail of
+ * @count: incremented for every string inserted
+ *
+ * Return: false with errno set to EINVAL if the snapshot is corrupted or a
+ * string holds a zero byte, or to ENOMEM if an insertion failed
+ */
+bool snapshot_load(const snapshot_t *snap,
+                   uint32_t i,
+                   struct list_head *head,
+                   int *count);
+
+/* Unmap a snapshot opened by snapshot_open() */
+void snapshot_close(snapshot_t *snap);
+
+#endif /* LAB0_SNAPSHOT_H */
@@ -0,0 +1,552 @@
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+
+#include "extsort.h"
+#include "pool.h"
+#include "sort.h"
+
+/* Buckets with fewer elements than this are handed to merge_sort() */
+#define RADIX_CUTOFF 32
+
+/* Splits nested deeper than this fall back to merge_sort(), which bounds the
+ * stack used on long shared prefixes to a few hundred KiB
+ */
+#define RADIX_MAX_LEVEL 64
+
+/* Strings the external sort handles between two looks at pending signals */
+#define EXTERNAL_POLL 4096
+
+/* Each thread of a parallel sort gets at least this many elements */
+#define PARALLEL_MIN_PART 16384
+
+/* Nodes taken in a row from one list before merge_sorted() starts galloping */
+#define MIN_GALLOP 7
+
+/* Runs pending in natural_sort(). Their lengths grow at least like the
+ * Fibonacci numbers from the top of the stack down, so this covers any list.
+ */
+#define MAX_PENDING 96
+
+int sort_memory = 64 << 10;
+
+/* Whether @node goes before @pivot in a merge: it is not greater, or with
+ * @strict it is less
+ */
+static inline bool goes_before(struct list_head *node,
+                               const element_t *pivot,
+                               bool strict)
+{
+    int cmp = element_cmp(list_entry(node, element_t, list), pivot);
+    return strict ? cmp < 0 : cmp <= 0;
+}
+
+/* Last node of @list which goes before @pivot, NULL if the first one does not.
+ * Nodes are probed at distances 1, 2, 4... and then by bisection, so a stretch
+ * of k nodes costs O(log k) comparisons, though still k steps.
+ */
+static struct list_head *gallop(struct list_head *list,
+                                const element_t *pivot,
+                                bool strict)
+{
+    if (!goes_before(list, pivot, strict))
+        return NULL;
+
+    /* @lo goes before @pivot, the node @dist steps past it does not */
+    struct list_head *lo = list;
+    size_t dist;
+    for (size_t step = 1;; step <<= 1) {
+        struct list_head *hi = lo;
+        for (dist = 0; dist < step && hi->next; dist++)
+            hi = hi->next;
+        if (!dist)
+            return lo;
+        if (!goes_before(hi, pivot, strict))
+            break;
+        lo = hi;
+    }
+    while (dist > 1) {
+        size_t half = dist / 2;
+        struct list_head *mid = lo;
+        for (size_t i = 0; i < half; i++)
+            mid = mid->next;
+        if (goes_before(mid, pivot, strict)) {
+            lo = mid;
+            dist -= half;
+        } else {
+            dist = half;
+        }
+    }
+    return lo;
+}
+
+struct list_head *merge_sorted(struct list_head *a, struct list_head *b)
+{
+    struct list_head *head = NULL, **tail = &head;
+    int streak = 0; /* Nodes taken in a row, from @a if positive, else @b */
+
+    while (a && b) {
+        struct list_head *last;
+        if (streak >= MIN_GALLOP) {
+            /* One list keeps winning: take its whole stretch at once */
+            streak = 0;
+            last = gallop(a, list_entry(b, element_t, list), false);
+            if (last) {
+                *tail = a;
+                tail = &last->next;
+                a = last->next;
+            }
+        } else if (streak <= -MIN_GALLOP) {
+            streak = 0;
+            last = gallop(b, list_entry(a, element_t, list), true);
+            if (last) {
+                *tail = b;
+                tail = &last->next;
+                b = last->next;
+            }
+        } else if (element_cmp(list_entry(a, element_t, list),
+                               list_entry(b, element_t, list)) <= 0) {
+            streak = streak > 0 ? streak + 1 : 1;
+            *tail = a;
+            tail = &a->next;
+            a = a->next;
+        } else {
+            streak = streak < 0 ? streak - 1 : -1;
+            *tail = b;
+            tail = &b->next;
+            b = b->next;
+        }
+    }
+    *tail = a ? a : b;
+    return head;
+}
+
+/* Slot i of @run holds a sorted run of 2^i nodes or NULL, and every incoming
+ * node is carried through it like a binary counter.
+ */
+struct list_head *merge_sort(struct list_head *list)
+{
+    struct list_head *run[32] = {NULL};
+    struct list_head *result = NULL;
+
+    while (list) {
+        struct list_head *cur = list;
+        list = list->next;
+        cur->next = NULL;
+
+        int i = 0;
+        for (; run[i]; i++) {
+            cur = merge_sorted(run[i], cur);
+            run[i] = NULL;
+        }
+        run[i] = cur;
+    }
+    for (int i = 0; i < 32; i++) {
+        if (run[i])
+            result = merge_sorted(run[i], result);
+    }
+    return result;
+}
+
+/* Byte @depth of the string of @e. The first 8 come from the cached key, so
+ * short strings are distributed without loading them. The newline ending a
+ * mapped line reads as the terminator.
+ */
+static inline unsigned char byte_at(const element_t *e, size_t depth)
+{
+    if (depth < 8)
+        return (e->key >> (56 - 8 * depth)) & 0xff;
+    unsigned char c = e->value[depth];
+    return c == '\n' ? 0 : c;
+}
+
+/* Length of the prefix shared by all strings of @list, which are known to
+ * share their first @depth bytes. Comparison stops at a terminator, so it
+ * never reads past the end of a string.
+ */
+static size_t common_prefix(struct list_head *list, size_t depth)
+{
+    const element_t *first = list_entry(list, element_t, list);
+    size_t lcp = SIZE_MAX;
+
+    for (list = list->next; list && lcp > depth; list = list->next) {
+        const element_t *e = list_entry(list, element_t, list);
+        size_t d = depth;
+        unsigned char c;
+        while (d < lcp && (c = byte_at(first, d)) && c == byte_at(e, d))
+            d++;
+        lcp = d;
+    }
+    return lcp == SIZE_MAX ? depth : lcp;
+}
+
+/* Sort @list, whose strings all share their first @depth bytes, and append
+ * it at @out. Return where the next list should be appended.
+ */
+static struct list_head **radix_level(struct list_head *list,
+                                      size_t depth,
+                                      int level,
+                                      struct list_head **out)
+{
+    struct list_head *bucket[256], **tail[256];
+    size_t count[256];
+
+    if (!list)
+        return out;
+
+    for (;;) {
+        size_t n = 0;
+        unsigned char b = 0;
+        for (int i = 0; i < 256; i++) {
+            tail[i] = &bucket[i];
+            count[i] = 0;
+        }
+        for (; list; list = list->next, n++) {
+            b = byte_at(list_entry(list, element_t, list), depth);
+            *tail[b] = list;
+            tail[b] = &list->next;
+            count[b]++;
+        }
+
+        /* Everything went to one bucket: skip the bytes all strings share
+         * instead of recursing once per byte. Bucket 0 holds strings which
+         * ended, so they are equal.
+         */
+        if (b && count[b] == n) {
+            *tail[b] = NULL;
+            list = bucket[b];
+            depth = common_prefix(list, depth + 1);
+            continue;
+        }
+        break;
+    }
+
+    for (int i = 0; i < 256; i++) {
+        if (!count[i])
+            continue;
+        *tail[i] = NULL;
+        if (!i) {
+            *out = bucket[0];
+            out = tail[0];
+        } else if (count[i] < RADIX_CUTOFF || level >= RADIX_MAX_LEVEL) {
+            *out = merge_sort(bucket[i]);
+            while (*out)
+                out = &(*out)->next;
+        } else {
+            out = radix_level(bucket[i], depth + 1, level + 1, out);
+        }
+    }
+    return out;
+}
+
+struct list_head *radix_sort(struct list_head *list)
+{
+    struct list_head *result = NULL;
+    radix_level(list, 0, 0, &result);
+    return result;
+}
+
+/* Link the NULL-terminated @list into the empty queue @head, restoring the
+ * prev links
+ */
+static void relink(struct list_head *head, struct list_head *list)
+{
+    struct list_head *prev = head;
+    for (struct list_head *node = list; node; node = node->next) {
+        node->prev = prev;
+        prev->next = node;
+        prev = node;
+    }
+    prev->next = head;
+    head->prev = prev;
+}
+
+void sort_list_head(struct list_head *head, sort_func_t sort)
+{
+    if (list_empty(head))
+        return;
+
+    head->prev->next = NULL;
+    relink(head, sort(head->next));
+}
+
+/**
+ * run_t - Sorted run pending in natural_sort()
+ * @head: first node
+ * @tail: last node, whose next is NULL
+ * @len: number of nodes
+ */
+typedef struct {
+    struct list_head *head, *tail;
+    size_t len;
+} run_t;
+
+static inline int node_cmp(struct list_head *a, struct list_head *b)
+{
+    return element_cmp(list_entry(a, element_t, list),
+                       list_entry(b, element_t, list));
+}
+
+/* Cut the natural run off the front of *@list: the longest nondecreasing
+ * stretch, or strictly decreasing one, which is reversed. Strictness keeps the
+ * sort stable. The first @known nodes are in order and are not compared.
+ */
+static run_t run_cut(struct list_head **list, size_t known)
+{
+    run_t run = {.head = *list, .tail = *list, .len = 1};
+    struct list_head *next = run.head->next;
+
+    if (known < 2 && next && node_cmp(next, run.head) < 0) {
+        run.tail->next = NULL;
+        while (next && node_cmp(next, run.head) < 0) {
+            struct list_head *tmp = next->next;
+            next->next = run.head;
+            run.head = next;
+            next = tmp;
+            run.len++;
+        }
+    } else {
+        while (next && (run.len < known || node_cmp(next, run.tail) >= 0)) {
+            run.tail = next;
+            next = next->next;
+            run.len++;
+        }
+        run.tail->next = NULL;
+    }
+    *list = next;
+    return run;
+}
+
+/* Merge @b, which came right after @a in the input, into @a */
+static void run_merge(run_t *a, const run_t *b)
+{
+    /* On ties nodes of @a go first, so the merged run ends with @b's tail
+     * unless @a's is greater
+     */
+    struct list_head *tail =
+        node_cmp(a->tail, b->tail) <= 0 ? b->tail : a->tail;
+
+    if (node_cmp(a->tail, b->head) <= 0) {
+        a->tail->next = b->head;
+    } else if (node_cmp(b->tail, a->head) < 0) {
+        b->tail->next = a->head;
+        a->head = b->head;
+    } else {
+        a->head = merge_sorted(a->head, b->head);
+    }
+    a->tail = tail;
+    a->len += b->len;
+}
+
+/* Merge the runs @k and @k + 1 of @stack, which holds @n runs */
+static void run_merge_at(run_t *stack, size_t n, size_t k)
+{
+    run_merge(&stack[k], &stack[k + 1]);
+    if (k + 2 < n)
+        stack[k + 1] = stack[k + 2];
+}
+
+struct list_head *natural_sort_known(struct list_head *list, size_t known)
+{
+    run_t stack[MAX_PENDING];
+    size_t n = 0;
+
+    while (list) {
+        stack[n++] = run_cut(&list, known);
+        known = 0;
+
+        /* Keep every pending run longer than the next two together, and
+         * than the next one, as TimSort does. Merges stay balanced and the
+         * stack logarithmic.
+         */
+        while (n > 1) {
+            size_t k = n - 2;
+            bool collapse =
+                k > 0 && stack[k - 1].len <= stack[k].len + stack[k + 1].len;
+            if (k > 1 && stack[k - 2].len <= stack[k - 1].len + stack[k].len)
+                collapse = true;
+            if (collapse) {
+                if (stack[k - 1].len < stack[k + 1].len)
+                    k--;
+            } else if (stack[k].len > stack[k + 1].len) {
+                break;
+            }
+            run_merge_at(stack, n--, k);
+        }
+    }
+
+    while (n > 1) {
+        size_t k = n - 2;
+        if (k > 0 && stack[k - 1].len < stack[k + 1].len)
+            k--;
+        run_merge_at(stack, n--, k);
+    }
+    return n ? stack[0].head : NULL;
+}
+
+struct list_head *natural_sort(struct list_head *list)
+{
+    return natural_sort_known(list, 0);
+}
+
+void sort_list_natural(struct list_head *head, size_t known)
+{
+    if (list_empty(head))
+        return;
+
+    head->prev->next = NULL;
+    relink(head, natural_sort_known(head->next, known));
+}
+
+/* Whether a signal held back by the external sort would be delivered once
+ * the mask @old is restored
+ */
+static bool signal_waiting(const sigset_t *old)
+{
+    sigset_t pending;
+    if (sigpending(&pending))
+        return false;
+    for (int sig = 1; sig < NSIG; sig++) {
+        if (sigismember(&pending, sig) == 1 && !sigismember(old, sig))
+            return true;
+    }
+    return false;
+}
+
+bool sort_list_external(struct list_head *head, size_t budget)
+{
+    extsort_t *ext = extsort_new(budget);
+    if (!ext)
+        return false;
+
+    /* Hold signals, so that the alarm of the harness does not leave the
+     * buffer and files of the sort behind, but look for one every few
+     * thousand strings. A waiting signal stops the sort with every element
+     * still in the queue, and is delivered once the sort is released.
+     */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    bool ok = true;
+    size_t n = 0;
+    element_t *entry;
+    list_for_each_entry (entry, head, list) {
+        if (!(++n % EXTERNAL_POLL) && signal_waiting(&old)) {
+            ok = false;
+            break;
+        }
+        ok = extsort_add(ext, entry->value, element_len(entry),
+                         (uintptr_t) entry);
+        if (!ok)
+            break;
+    }
+
+    /* Move the elements back as their strings come. Should reading fail or
+     * a signal come halfway, those left are put back behind them.
+     */
+    if (ok && !signal_waiting(&old) && extsort_finish(ext)) {
+        LIST_HEAD(pending);
+        const char *s;
+        size_t len;
+        uint64_t tag;
+        list_splice_init(head, &pending);
+        while (extsort_next(ext, &s, &len, &tag)) {
+            list_move_tail(&((element_t *) (uintptr_t) tag)->list, head);
+            if (!(++n % EXTERNAL_POLL) && signal_waiting(&old))
+                break;
+        }
+        ok = list_empty(&pending);
+        list_splice_tail(&pending, head);
+    } else {
+        ok = false;
+    }
+
+    extsort_free(ext);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return ok;
+}
+
+/**
+ * sort_job_t - Work handed to one thread of a parallel sort
+ * @sort: sorting engine, NULL when the job is a merge
+ * @list: input, a sublist to sort or the first of two runs to merge
+ * @other: second run to merge
+ * @result: sorted output
+ */
+typedef struct {
+    sort_func_t sort;
+    struct list_head *list;
+    struct list_head *other;
+    struct list_head *result;
+} sort_job_t;
+
+static void sort_job(void *arg)
+{
+    sort_job_t *job = arg;
+    job->result = job->sort ? job->sort(job->list)
+                            : merge_sorted(job->list, job->other);
+}
+
+/* Run @jobs[0] to @jobs[n - 1] concurrently on the pool */
+static void run_jobs(sort_job_t *jobs, int n)
+{
+    pool_task_t tasks[POOL_MAX_THREADS];
+    for (int i = 0; i < n; i++)
+        tasks[i] = (pool_task_t){.func = sort_job, .arg = &jobs[i]};
+    pool_run(tasks, n);
+}
+
+void sort_list_parallel(struct list_head *head, sort_func_t sort, int threads)
+{
+    struct list_head *node;
+    size_t n = 0;
+    list_for_each (node, head)
+        n++;
+
+    if (threads > POOL_MAX_THREADS)
+        threads = POOL_MAX_THREADS;
+    if ((size_t) threads > n / PARALLEL_MIN_PART)
+        threads = n / PARALLEL_MIN_PART;
+    if (threads < 2) {
+        sort_list_head(head, sort);
+        return;
+    }
+
+    /* Cut the queue into contiguous parts, so that merging them left to
+     * right keeps the sort stable.
+     */
+    struct list_head part[POOL_MAX_THREADS];
+    sort_job_t jobs[POOL_MAX_THREADS];
+    for (int i = 0; i < threads; i++) {
+        INIT_LIST_HEAD(&part[i]);
+        if (i == threads - 1) {
+            list_splice_init(head, &part[i]);
+        } else {
+            size_t len = n / threads;
+            node = head;
+            while (len--)
+                node = node->next;
+            list_cut_position(&part[i], head, node);
+        }
+        part[i].prev->next = NULL;
+        jobs[i] = (sort_job_t){.sort = sort, .list = part[i].next};
+    }
+    run_jobs(jobs, threads);
+
+    /* Merge neighbouring runs pairwise until one is left */
+    struct list_head *run[POOL_MAX_THREADS];
+    for (int i = 0; i < threads; i++)
+        run[i] = jobs[i].result;
+    for (int count = threads; count > 1; count = (count + 1) / 2) {
+        int pairs = count / 2;
+        for (int i = 0; i < pairs; i++)
+            jobs[i] = (sort_job_t){.list = run[2 * i], .other = run[2 * i + 1]};
+        run_jobs(jobs, pairs);
+        for (int i = 0; i < pairs; i++)
+            run[i] = jobs[i].result;
+        if (count & 1)
+            run[pairs] = run[count - 1];
+    }
+    relink(head, run[0]);
+}
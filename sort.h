@@ -0,0 +1,142 @@
+#ifndef LAB0_SORT_H
+#define LAB0_SORT_H
+
+/* Sorting engines behind q_sort() and the element ordering they share with
+ * the rest of queue.c.
+ *
+ * The engines work on a list which is terminated by NULL and linked by next
+ * only, and return it sorted in the same form. sort_list_head() wraps one of
+ * them for a circular doubly-linked queue.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "queue.h"
+
+/* Pack the first 8 bytes of @s into an integer which orders like the string.
+ * A newline ends @s like the terminator does, see element_len().
+ */
+static inline uint64_t key_of(const char *s)
+{
+    uint64_t key = 0;
+    for (int i = 0; i < 8 && s[i] && s[i] != '\n'; i++)
+        key |= (uint64_t) (unsigned char) s[i] << (56 - 8 * i);
+    return key;
+}
+
+/* Length of the string of an element. Mapped files are never written, so
+ * their lines end at the newline instead, which no other string holds.
+ */
+static inline size_t element_len(const element_t *e)
+{
+    return e->mapped ? strcspn(e->value, "\n") : strlen(e->value);
+}
+
+/* Compare two strings like strcmp() does, a newline ending them as well */
+static inline int line_cmp(const char *a, const char *b)
+{
+    for (;; a++, b++) {
+        unsigned char x = *a == '\n' ? 0 : *a;
+        unsigned char y = *b == '\n' ? 0 : *b;
+        if (x != y || !x)
+            return x - y;
+    }
+}
+
+/* Compare two elements like strcmp() does with their strings */
+static inline int element_cmp(const element_t *a, const element_t *b)
+{
+    if (a->key != b->key)
+        return a->key < b->key ? -1 : 1;
+
+    /* Equal keys with a zero low byte: both strings end within the prefix */
+    if (!(a->key & 0xff))
+        return 0;
+    if (a->mapped || b->mapped)
+        return line_cmp(a->value + 8, b->value + 8);
+    return strcmp(a->value + 8, b->value + 8);
+}
+
+/* Whether two elements hold equal strings */
+static inline bool element_eq(const element_t *a, const element_t *b)
+{
+#if defined(QUEUE_INTERN) && !defined(QUEUE_BACKEND_UNROLLED)
+    /* Equal strings share one interned copy, unless one is in a mapped file */
+    if (a->value == b->value)
+        return true;
+    return (a->mapped || b->mapped) && a->key == b->key &&
+           !element_cmp(a, b);
+#else
+    return a->key == b->key && !element_cmp(a, b);
+#endif
+}
+
+/* Algorithms q_sort() can use */
+typedef enum {
+    SORT_MERGE,    /* Stable bottom-up merge sort */
+    SORT_RADIX,    /* MSD radix sort on the string bytes */
+    SORT_EXTERNAL, /* Merge sort through temporary files, see extsort.h */
+} sort_mode_t;
+
+/* Algorithm used by q_sort(), settable with "option sort" in qtest */
+extern int sort_mode;
+
+/* Memory in KiB the external sort may use, "option sortmem" in qtest */
+extern int sort_memory;
+
+typedef struct list_head *(*sort_func_t)(struct list_head *list);
+
+/* Merge two sorted lists. On ties @a goes first, which keeps sorts stable.
+ * A long stretch won by one list is skipped with few comparisons.
+ */
+struct list_head *merge_sorted(struct list_head *a, struct list_head *b);
+
+/* Stable bottom-up merge sort */
+struct list_head *merge_sort(struct list_head *list);
+
+/* Stable MSD radix sort on the bytes of the strings */
+struct list_head *radix_sort(struct list_head *list);
+
+/* Stable natural merge sort, close to linear time on nearly sorted lists */
+struct list_head *natural_sort(struct list_head *list);
+
+/* Same as natural_sort(), the first @known nodes being in order already */
+struct list_head *natural_sort_known(struct list_head *list, size_t known);
+
+/* Sort the queue @head with @sort and restore its prev links */
+void sort_list_head(struct list_head *head, sort_func_t sort);
+
+/* Sort the queue @head, whose first @known elements are in order, with
+ * natural_sort_known() and restore its prev links
+ */
+void sort_list_natural(struct list_head *head, size_t known);
+
+/**
+ * sort_list_external() - Sort a queue through temporary files
+ * @head: header of queue
+ * @budget: bytes of memory the sort may use
+ *
+ * The strings are sorted by extsort.h along with the address of their
+ * elements, and the elements are then relinked in the order they come back.
+ * Memory is allocated outside of the harness, and only up to @budget.
+ * Signals are held during the sort, which stops early when one is waiting.
+ *
+ * Return: false if the sort failed or was stopped, leaving the queue in some
+ * order
+ */
+bool sort_list_external(struct list_head *head, size_t budget);
+
+/**
+ * sort_list_parallel() - Sort a queue on several threads
+ * @head: header of queue
+ * @sort: engine sorting each part
+ * @threads: number of parts, capped so that each holds enough elements
+ *
+ * The queue is cut into contiguous parts which are sorted concurrently and
+ * then merged pairwise, also concurrently. Nothing is allocated, and the
+ * result is the same as sort_list_head() gives.
+ */
+void sort_list_parallel(struct list_head *head, sort_func_t sort, int threads);
+
+#endif /* LAB0_SORT_H */
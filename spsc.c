@@ -0,0 +1,98 @@
+#include <stdatomic.h>
+
+#include "cacheline.h"
+#include "spsc.h"
+
+/**
+ * struct spsc - Ring and the two sides of it
+ * @slot: the ring of element pointers
+ * @mask: number of slots minus one
+ * @tail: position the producer inserts at next
+ * @head_cache: value of @head last read by the producer
+ * @head: position the consumer removes from next
+ * @tail_cache: value of @tail last read by the consumer
+ */
+struct spsc {
+    element_t **slot;
+    size_t mask;
+    char pad0[CACHE_LINE - sizeof(element_t **) - sizeof(size_t)];
+
+    /* Producer side */
+    atomic_size_t tail;
+    size_t head_cache;
+    char pad1[CACHE_LINE - sizeof(atomic_size_t) - sizeof(size_t)];
+
+    /* Consumer side */
+    atomic_size_t head;
+    size_t tail_cache;
+    char pad2[CACHE_LINE - sizeof(atomic_size_t) - sizeof(size_t)];
+};
+
+spsc_t *spsc_new(size_t capacity)
+{
+    size_t cap = 2;
+    while (cap < capacity)
+        cap <<= 1;
+
+    spsc_t *q = malloc(sizeof(spsc_t));
+    if (!q)
+        return NULL;
+    q->slot = malloc(cap * sizeof(element_t *));
+    if (!q->slot) {
+        free(q);
+        return NULL;
+    }
+    q->mask = cap - 1;
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->head, 0);
+    q->head_cache = 0;
+    q->tail_cache = 0;
+    return q;
+}
+
+void spsc_free(spsc_t *q)
+{
+    if (!q)
+        return;
+    free(q->slot);
+    free(q);
+}
+
+size_t spsc_insert_tail(spsc_t *q, element_t *const *e, size_t n)
+{
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t room = q->mask + 1 - (tail - q->head_cache);
+    if (room < n) {
+        q->head_cache = atomic_load_explicit(&q->head, memory_order_acquire);
+        room = q->mask + 1 - (tail - q->head_cache);
+        if (room < n)
+            n = room;
+    }
+
+    if (!n)
+        return 0;
+    for (size_t i = 0; i < n; i++)
+        q->slot[(tail + i) & q->mask] = e[i];
+    atomic_store_explicit(&q->tail, tail + n, memory_order_release);
+    return n;
+}
+
+size_t spsc_remove_head(spsc_t *q, element_t **e, size_t n)
+{
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t avail = q->tail_cache - head;
+    if (avail < n) {
+        q->tail_cache = atomic_load_explicit(&q->tail, memory_order_acquire);
+        avail = q->tail_cache - head;
+        if (avail < n)
+            n = avail;
+    }
+
+    /* Leave the line of the index alone when there is nothing to take */
+    if (!n)
+        return 0;
+    for (size_t i = 0; i < n; i++)
+        e[i] = q->slot[(head + i) & q->mask];
+    atomic_store_explicit(&q->head, head + n, memory_order_release);
+    return n;
+}
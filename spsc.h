@@ -0,0 +1,52 @@
+#ifndef LAB0_SPSC_H
+#define LAB0_SPSC_H
+
+/* Bounded wait-free queue of elements for one producer and one consumer.
+ *
+ * A ring of element pointers with a tail index written only by the producer
+ * and a head index written only by the consumer, on separate cache lines.
+ * Each side also keeps a copy of the index of the other side, and reads the
+ * real one only when its copy says the ring is full, or empty. Elements move
+ * in batches: a batch is published with a single store of the index, so the
+ * line holding it changes hands once per batch instead of once per element.
+ */
+
+#include <stddef.h>
+
+#include "queue.h"
+
+typedef struct spsc spsc_t;
+
+/**
+ * spsc_new() - Create an empty queue
+ * @capacity: number of elements it can hold, rounded up to a power of two
+ *
+ * Return: NULL for allocation failed
+ */
+spsc_t *spsc_new(size_t capacity);
+
+/* Free a queue, which neither side uses any more. Elements are left alone */
+void spsc_free(spsc_t *q);
+
+/**
+ * spsc_insert_tail() - Insert elements at the tail, from the producer
+ * @q: the queue
+ * @e: elements to insert, in order
+ * @n: number of elements in @e
+ *
+ * Return: the number of elements inserted, the first ones of @e, which is
+ * less than @n if the queue filled up
+ */
+size_t spsc_insert_tail(spsc_t *q, element_t *const *e, size_t n);
+
+/**
+ * spsc_remove_head() - Remove elements from the head, from the consumer
+ * @q: the queue
+ * @e: array receiving the elements, in order
+ * @n: room in @e
+ *
+ * Return: the number of elements removed, zero if the queue is empty
+ */
+size_t spsc_remove_head(spsc_t *q, element_t **e, size_t n);
+
+#endif /* LAB0_SPSC_H */
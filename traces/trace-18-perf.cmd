@@ -0,0 +1,14 @@
+# Test performance of descend
+# 1000000: descend with O(n^2) time complexity is expected failed
+option fail 0
+option malloc 0
+new
+ih dolphin 1000000
+descend
+free
+new
+it gerbil 1000000
+it dolphin 1000
+ih aardvark 1000
+descend
+free
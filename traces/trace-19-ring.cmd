@@ -0,0 +1,8 @@
+# Test the ring deque against a queue, at sizes around its growth
+option fail 0
+option malloc 0
+ring 1
+ring 2
+ring 3
+ring 1000
+ring 100000
@@ -0,0 +1,26 @@
+# Test the external sort on empty, random, sorted, reversed and
+# duplicate-heavy queues, over several runs of its smallest budget
+option fail 0
+option malloc 0
+option sort 2
+option sortmem 256
+new
+sort
+ih RAND 20000
+sort
+reverseK 2
+reverseK 2
+sort
+reverse
+reverseK 2
+reverseK 2
+sort
+free
+new
+ih dolphin 5000
+it aardvark 5000
+ih RAND 2500
+it dolphin 5000
+ih gerbil 2500
+sort
+free
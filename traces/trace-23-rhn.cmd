@@ -0,0 +1,20 @@
+# Test of removing several elements from the head at once
+option fail 0
+option malloc 0
+new
+rhn
+rhn 3
+ih RAND 10
+rhn 0
+rhn -1
+rhn 3
+rhn 100
+it gerbil 5
+ih dolphin 5
+rhn
+free
+new
+ih RAND 200000
+rhn 100000
+rhn
+free
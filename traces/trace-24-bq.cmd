@@ -0,0 +1,8 @@
+# Test the blocking queue with more, fewer and as many producers as consumers
+option fail 0
+option malloc 0
+bq 1
+bq 1000 1 1
+bq 100000 1 4
+bq 100000 4 1
+bq 100000 4 4
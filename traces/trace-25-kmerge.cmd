@@ -0,0 +1,9 @@
+# Test merging many queues on one thread and on the thread pool
+option fail 0
+option malloc 0
+option threads 4
+kmerge 0 8
+kmerge 100 4
+kmerge 100000 64
+option threads 1
+kmerge 10000 16
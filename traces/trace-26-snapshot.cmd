@@ -0,0 +1,15 @@
+# Test saving queues to snapshots and loading them back, and that snapshots
+# cut short or corrupted are refused
+option fail 0
+option malloc 0
+snap 1
+snap 2
+snap 1000
+snap 100000
+new
+ih RAND 1000
+new
+it gerbil 10
+new
+save /tmp/lab0-trace-26.snap all
+load /tmp/lab0-trace-26.snap
@@ -0,0 +1,32 @@
+# Test queues of the lines of text files, mixed with copied strings
+option fail 0
+option malloc 0
+mapq /dev/null
+mapq README.md
+it aardvark 10
+ih zebra 10
+sort
+dedup
+reverse
+option sort 1
+sort
+reverse
+option sort 2
+sort
+mapq traces/trace-27-mapq.cmd
+ih gerbil 5
+sort
+merge
+save /tmp/lab0-trace-27.snap
+load /tmp/lab0-trace-27.snap
+prev
+rh
+rt
+dm
+swap
+reverseK 3
+descend
+size
+option reclaim 1
+free
+free
@@ -0,0 +1,29 @@
+# Test freeing queues in the background, while the console goes on
+option fail 0
+option malloc 0
+option reclaim 1
+new
+ih dolphin 100000
+new
+it gerbil 1000
+new
+ih RAND 50000
+free
+ih aardvark 10
+rh aardvark
+sync
+free
+prev
+rhn 500
+it zebra 500
+sort
+free
+new
+ih RAND 1000
+sync
+free
+sync
+option reclaim 0
+new
+ih dolphin 10
+free
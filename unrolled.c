@@ -0,0 +1,117 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mapq.h"
+#include "unrolled.h"
+#ifdef QUEUE_INTERN
+#include "intern.h"
+#endif
+
+/* One slot per cache line: the element, its chunk and a short string */
+typedef struct {
+    element_t elem;
+    struct __unrolled_chunk *chunk;
+    char str[UNROLLED_INLINE_LEN];
+} __attribute__((aligned(UNROLLED_LINE))) slot_t;
+
+/* The header of a chunk is padded to a full line by the alignment of slots */
+typedef struct __unrolled_chunk {
+    struct list_head list;
+    void *block;       /* Address returned by malloc, before alignment */
+    unsigned int used; /* Slots handed out so far */
+    unsigned int live; /* Slots handed out and not yet released */
+    slot_t slots[UNROLLED_SLOTS];
+} chunk_t;
+
+static chunk_t *chunk_new(struct list_head *chunks)
+{
+    /* Allocator only guarantees 16-byte alignment, so over-allocate a line */
+    void *block = malloc(sizeof(chunk_t) + UNROLLED_LINE - 1);
+    if (!block)
+        return NULL;
+
+    chunk_t *chunk = (chunk_t *) (((uintptr_t) block + UNROLLED_LINE - 1) &
+                                  ~((uintptr_t) UNROLLED_LINE - 1));
+    chunk->block = block;
+    chunk->used = 0;
+    chunk->live = 0;
+    list_add_tail(&chunk->list, chunks);
+    return chunk;
+}
+
+element_t *unrolled_element_new(struct list_head *chunks, const char *s)
+{
+    chunk_t *chunk =
+        list_empty(chunks) ? NULL : list_last_entry(chunks, chunk_t, list);
+    if (!chunk || chunk->used == UNROLLED_SLOTS) {
+        chunk = chunk_new(chunks);
+        if (!chunk)
+            return NULL;
+    }
+
+    slot_t *slot = &chunk->slots[chunk->used];
+    size_t len = strlen(s) + 1;
+    char *value = slot->str;
+    if (len <= UNROLLED_INLINE_LEN) {
+        memcpy(value, s, len);
+    } else {
+#ifdef QUEUE_INTERN
+        value = intern_get(s);
+#else
+        value = malloc(len);
+        if (value)
+            memcpy(value, s, len);
+#endif
+        if (!value)
+            return NULL;
+    }
+
+    chunk->used++;
+    chunk->live++;
+    slot->chunk = chunk;
+    slot->elem.value = value;
+    return &slot->elem;
+}
+
+/* Replace the inline version in queue.h, as slots are not heap blocks */
+void q_release_element(element_t *e)
+{
+    if (e->mapped) {
+        mapq_release(e);
+        return;
+    }
+
+    slot_t *slot = container_of(e, slot_t, elem);
+    chunk_t *chunk = slot->chunk;
+
+    if (e->value != slot->str) {
+#ifdef QUEUE_INTERN
+        intern_put(e->value);
+#else
+        free(e->value);
+#endif
+    }
+
+    if (--chunk->live)
+        return;
+
+    /* Keep a partially used chunk of a live queue for further inserts */
+    if (chunk->used == UNROLLED_SLOTS || list_empty(&chunk->list)) {
+        list_del(&chunk->list);
+        free(chunk->block);
+    }
+}
+
+void unrolled_free(struct list_head *chunks)
+{
+    chunk_t *chunk, *safe;
+    list_for_each_entry_safe (chunk, safe, chunks, list) {
+        if (chunk->live) {
+            list_del_init(&chunk->list);
+        } else {
+            list_del(&chunk->list);
+            free(chunk->block);
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef LAB0_UNROLLED_H
+#define LAB0_UNROLLED_H
+
+/* Unrolled storage backend for the queue.
+ *
+ * Instead of allocating every element_t and its string as two separate heap
+ * blocks, elements are carved out of cache-line-aligned chunks. Each chunk is
+ * a run of UNROLLED_SLOTS slots, one cache line each, holding the element_t,
+ * a pointer back to the owning chunk and, for short strings, the string
+ * itself. A queue keeps its chunks on a doubly-linked list, so elements that
+ * were inserted one after another sit next to each other in memory.
+ *
+ * Enabled with "make BACKEND=unrolled".
+ */
+
+#include "queue.h"
+
+/* Size of a slot, which is also the alignment of a chunk */
+#define UNROLLED_LINE 64
+
+/* Number of slots per chunk; the chunk header takes the remaining line */
+#define UNROLLED_SLOTS 63
+
+/* Strings shorter than this are stored inside the slot */
+#define UNROLLED_INLINE_LEN \
+    (UNROLLED_LINE - sizeof(element_t) - sizeof(void *))
+
+/**
+ * unrolled_element_new() - Allocate an element from the chunks of a queue
+ * @chunks: list of chunks owned by the queue
+ * @s: string to be copied into the element
+ *
+ * Return: the new element, NULL for allocation failed
+ */
+element_t *unrolled_element_new(struct list_head *chunks, const char *s);
+
+/* With this backend q_release_element() gives the slot back to its chunk.
+ * The chunk is freed once it has handed out all of its slots and every one of
+ * them has been released, or once its queue is gone and it becomes empty.
+ */
+
+/**
+ * unrolled_free() - Release the chunks of a queue that is being freed
+ * @chunks: list of chunks owned by the queue
+ *
+ * Empty chunks are freed. Chunks that still hold removed but not yet released
+ * elements are detached, and freed when q_release_element() releases the last
+ * of them.
+ */
+void unrolled_free(struct list_head *chunks);
+
+#endif /* LAB0_UNROLLED_H */